@@ -0,0 +1,89 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "LightingBuildOptions.h"
+#include "Commandlets/Commandlet.h"
+#include "HAL/PlatformProcess.h"
+#include "CustomLightingBuildCommandlet.generated.h"
+
+class FCustomStaticLightingSystem;
+
+/**
+ * Headless custom lighting builds, e.g. for CPU-only build farms:
+ * UnrealEditor-Cmd <Project> -run=CustomLightingBuild -System=<Name> -Maps=<A>+<B> [-Scenarios=<X>+<Y>]
+ *     [-Quality=Preview|Medium|High|Production] [-CoreBudget=<N>] [-CoresPerJob=<N>] [-Shards=<N>] [-Report=<Path.csv>]
+ *
+ * Every map & scenario pair is one job. When the core budget allows more than one job at a time,
+ * each of them runs in its own child process with its own Swarm job, and Lightmass is capped to CoresPerJob threads.
+ * -LightmassThreads=<N> caps Lightmass threads in any editor process, this is what child processes are given.
+ *
+ * With -Shards, jobs run one at a time and the primitives of each are split into N shards solved concurrently.
+ * This process solves shard 0 and the others run in child processes once its export has filled the Swarm cache,
+ * so meshes & materials are only exported once. Their mesh build data is merged into the levels before saving,
+ * level wide data (volumes, stationary light shadows) comes from shard 0.
+ * Shards can't be jobs of a single processor: NSwarm::FSwarmInterface is one connection per editor process with one open job,
+ * and the local agent runs a single Lightmass instance per job, so each extra local Lightmass process needs its own editor.
+ * The speed-up is reported against the last single job of the same map & scenario in the previous report.
+ * Only compiled with the lightmass patches (EXTENSIBILITY_LIGHTMASS=1), systems are provided by plugins through RegisterSystem.
+ */
+UCLASS()
+class UNREALED_API UCustomLightingBuildCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	using FSystemFactory = TFunction<FCustomStaticLightingSystem*(const FLightingBuildOptions&, UWorld*, ULevel* /* LightingScenario */)>;
+
+	static void RegisterSystem(FName Name, FSystemFactory Factory);
+	static void UnregisterSystem(FName Name);
+
+	UCustomLightingBuildCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+private:
+	struct FJob
+	{
+		FString Map;
+		FString Scenario;
+	};
+
+	struct FJobReport
+	{
+		FString Status;
+		double LoadTime = 0.0;
+		double BuildTime = 0.0;
+		double SaveTime = 0.0;
+		int32 NumShards = 1;
+		// Against the baseline single job, zero if there is none
+		double SpeedUp = 0.0;
+	};
+
+	int32 RunJobsInChildProcesses(const TArray<FJob>& Jobs, int32 MaxConcurrentJobs);
+	bool RunJob(const FJob& Job, FJobReport& Report);
+
+	FString GetChildParams(const FJob& Job, const FString& ChildReportPath) const;
+	TArray<FProcHandle> LaunchShards(const FJob& Job, const FString& JobShardDir) const;
+	bool SaveShardBuildData(UWorld* World, ULevel* LightingScenario) const;
+	bool MergeShards(UWorld* World, ULevel* LightingScenario, const FString& JobShardDir) const;
+
+	static FString GetReportHeader();
+	static FString GetReportLine(const FJob& Job, const FJobReport& Report);
+
+	FName SystemName;
+	FString QualityName;
+	FString ReportPath;
+	FLightingBuildOptions Options;
+	int32 CoresPerJob = 16;
+
+	int32 NumShards = 1;
+	// Shard children only
+	int32 ShardIndex = 0;
+	FString ShardDir;
+	uint32 ShardParentId = 0;
+
+	// Build seconds of the single jobs in the previous report, by map & scenario
+	TMap<FString, double> BaselineBuildTimes;
+};
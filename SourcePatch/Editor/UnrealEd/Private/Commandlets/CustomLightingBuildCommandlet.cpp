@@ -0,0 +1,621 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "Commandlets/CustomLightingBuildCommandlet.h"
+
+#include "Editor.h"
+#include "EditorLevelUtils.h"
+#include "ExtensibilityUnrealEd.h"
+#include "PackageHelperFunctions.h"
+#include "Engine/LevelStreaming.h"
+#include "Engine/MapBuildDataRegistry.h"
+#include "HAL/FileManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/PackageName.h"
+#include "Misc/Paths.h"
+#include "UObject/UObjectHash.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogCustomLightingBuild, Log, All);
+
+static TMap<FName, UCustomLightingBuildCommandlet::FSystemFactory>& GetSystemFactories()
+{
+	static TMap<FName, UCustomLightingBuildCommandlet::FSystemFactory> Factories;
+	return Factories;
+}
+
+static FString GetShardBuildDataPath(const FString& JobShardDir, int32 Shard, const FString& PackageName)
+{
+	return JobShardDir / FString::FromInt(Shard) / PackageName.Replace(TEXT("/"), TEXT("_")) + FPackageName::GetAssetPackageExtension();
+}
+
+static TArray<UMapBuildDataRegistry*> GetBuildDataRegistries(UWorld* World, ULevel* LightingScenario)
+{
+	TArray<UMapBuildDataRegistry*> Registries;
+	for (ULevel* Level : World->GetLevels())
+	{
+		const ULevel* DataLevel = LightingScenario ? LightingScenario : Level;
+		if (DataLevel->MapBuildData)
+		{
+			Registries.AddUnique(DataLevel->MapBuildData);
+		}
+	}
+	return Registries;
+}
+
+// Objects of a shard package referenced by the build data merged out of it, i.e. its lightmap & shadowmap textures
+class FShardBuildDataCollector : public FReferenceCollector
+{
+public:
+	explicit FShardBuildDataCollector(const UPackage* InPackage) : Package(InPackage) {}
+
+	bool IsIgnoringArchetypeRef() const override { return true; }
+	bool IsIgnoringTransient() const override { return true; }
+
+	void HandleObjectReference(UObject*& InObject, const UObject* InReferencingObject, const FProperty* InReferencingProperty) override
+	{
+		if (InObject && InObject->IsIn(Package))
+		{
+			Objects.Add(InObject);
+		}
+	}
+
+	const UPackage* Package;
+	TArray<UObject*> Objects;
+};
+
+void UCustomLightingBuildCommandlet::RegisterSystem(FName Name, FSystemFactory Factory)
+{
+	GetSystemFactories().Add(Name, MoveTemp(Factory));
+}
+
+void UCustomLightingBuildCommandlet::UnregisterSystem(FName Name)
+{
+	GetSystemFactories().Remove(Name);
+}
+
+UCustomLightingBuildCommandlet::UCustomLightingBuildCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCustomLightingBuildCommandlet::Main(const FString& Params)
+{
+	FString SystemStr, MapsStr, ScenariosStr;
+	FParse::Value(*Params, TEXT("System="), SystemStr);
+	FParse::Value(*Params, TEXT("Maps="), MapsStr);
+	FParse::Value(*Params, TEXT("Scenarios="), ScenariosStr);
+	QualityName = TEXT("Production");
+	FParse::Value(*Params, TEXT("Quality="), QualityName);
+
+	SystemName = *SystemStr;
+	if (!GetSystemFactories().Contains(SystemName))
+	{
+		UE_LOG(LogCustomLightingBuild, Error, TEXT("Unknown lighting system '%s', make sure the plugin providing it is enabled."), *SystemStr);
+		return 1;
+	}
+
+	ReportPath = FPaths::ProjectLogDir() / TEXT("CustomLightingBuild.csv");
+	FParse::Value(*Params, TEXT("Report="), ReportPath);
+
+	Options.bUseErrorColoring = false;
+	Options.bShowLightingBuildInfo = false;
+	if (QualityName == TEXT("Preview")) Options.QualityLevel = Quality_Preview;
+	else if (QualityName == TEXT("Medium")) Options.QualityLevel = Quality_Medium;
+	else if (QualityName == TEXT("High")) Options.QualityLevel = Quality_High;
+	else Options.QualityLevel = Quality_Production;
+
+	TArray<FString> Maps, Scenarios;
+	MapsStr.ParseIntoArray(Maps, TEXT("+"));
+	ScenariosStr.ParseIntoArray(Scenarios, TEXT("+"));
+	if (Scenarios.Num() == 0) Scenarios.AddDefaulted();
+
+	TArray<FJob> Jobs;
+	for (const FString& Map : Maps)
+	{
+		for (const FString& Scenario : Scenarios)
+		{
+			Jobs.Add({ Map, Scenario });
+		}
+	}
+
+	FParse::Value(*Params, TEXT("Shards="), NumShards);
+	FParse::Value(*Params, TEXT("Shard="), ShardIndex);
+	FParse::Value(*Params, TEXT("ShardDir="), ShardDir);
+	FParse::Value(*Params, TEXT("ShardParent="), ShardParentId);
+	NumShards = FMath::Max(NumShards, 1);
+
+	// Each job gets a whole Swarm job, which is only bound by the core budget
+	int32 CoreBudget = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+	FParse::Value(*Params, TEXT("CoreBudget="), CoreBudget);
+	CoresPerJob = NumShards > 1 ? FMath::Max(CoreBudget / NumShards, 1) : 16;
+	FParse::Value(*Params, TEXT("CoresPerJob="), CoresPerJob);
+
+	if (NumShards > 1)
+	{
+		// Shards are the concurrent jobs, shard 0 is solved by this process with the same share of cores
+		int32 LightmassThreads;
+		if (ShardDir.IsEmpty() && !FParse::Value(FCommandLine::Get(), TEXT("LightmassThreads="), LightmassThreads))
+		{
+			FCommandLine::Append(*FString::Printf(TEXT(" -LightmassThreads=%d"), CoresPerJob));
+		}
+	}
+	else
+	{
+		const int32 MaxConcurrentJobs = FMath::Clamp(CoreBudget / FMath::Max(CoresPerJob, 1), 1, FMath::Max(Jobs.Num(), 1));
+		if (MaxConcurrentJobs > 1)
+		{
+			return RunJobsInChildProcesses(Jobs, MaxConcurrentJobs);
+		}
+	}
+
+	// Single job build times of the previous run are the baseline of sharded builds
+	TArray<FString> PreviousReportLines;
+	FFileHelper::LoadFileToStringArray(PreviousReportLines, *ReportPath);
+	for (const FString& Line : PreviousReportLines)
+	{
+		TArray<FString> Columns;
+		Line.ParseIntoArray(Columns, TEXT(","), false);
+		// Reports from before sharding have no shard count
+		if (Columns.Num() >= 6 && Columns[2] == TEXT("Succeeded") && (Columns.Num() < 7 || FCString::Atoi(*Columns[6]) == 1))
+		{
+			BaselineBuildTimes.Add(Columns[0] + TEXT(",") + Columns[1], FCString::Atod(*Columns[4]));
+		}
+	}
+
+	TArray<FString> ReportLines{ GetReportHeader() };
+	int32 NumFailed = 0;
+	for (const FJob& Job : Jobs)
+	{
+		FJobReport Report;
+		if (!RunJob(Job, Report)) NumFailed++;
+		ReportLines.Add(GetReportLine(Job, Report));
+	}
+	FFileHelper::SaveStringArrayToFile(ReportLines, *ReportPath);
+
+	UE_LOG(LogCustomLightingBuild, Display, TEXT("%d of %d lighting builds succeeded, report written to %s"), Jobs.Num() - NumFailed, Jobs.Num(), *ReportPath);
+	return NumFailed ? 1 : 0;
+}
+
+FString UCustomLightingBuildCommandlet::GetChildParams(const FJob& Job, const FString& ChildReportPath) const
+{
+	// The child runs its single job in process, with Lightmass capped to the cores of one job
+	return FString::Printf(TEXT("\"%s\" -run=CustomLightingBuild -System=\"%s\" -Maps=\"%s\" -Scenarios=\"%s\" -Quality=%s -Report=\"%s\" -CoreBudget=1 -CoresPerJob=1 -LightmassThreads=%d")
+		TEXT(" -unattended -nopause -nullrhi -stdout -FullStdOutLogOutput"),
+		*FPaths::GetProjectFilePath(), *SystemName.ToString(), *Job.Map, *Job.Scenario, *QualityName, *ChildReportPath, CoresPerJob);
+}
+
+int32 UCustomLightingBuildCommandlet::RunJobsInChildProcesses(const TArray<FJob>& Jobs, int32 MaxConcurrentJobs)
+{
+	struct FRunningJob
+	{
+		int32 JobIndex;
+		FProcHandle Handle;
+		double StartTime;
+	};
+
+	auto GetJobReportPath = [this](int32 JobIndex)
+	{
+		return FPaths::ChangeExtension(ReportPath, FString::Printf(TEXT("%d.csv"), JobIndex));
+	};
+
+	TArray<FString> ReportLines{ GetReportHeader() };
+	TArray<FRunningJob> RunningJobs;
+	int32 NextJobIndex = 0;
+	int32 NumFailed = 0;
+
+	UE_LOG(LogCustomLightingBuild, Display, TEXT("Running %d lighting builds, %d at a time"), Jobs.Num(), MaxConcurrentJobs);
+
+	while (NextJobIndex < Jobs.Num() || RunningJobs.Num())
+	{
+		while (NextJobIndex < Jobs.Num() && RunningJobs.Num() < MaxConcurrentJobs)
+		{
+			const FJob& Job = Jobs[NextJobIndex];
+			FProcHandle Handle = FPlatformProcess::CreateProc(FPlatformProcess::ExecutablePath(), *GetChildParams(Job, GetJobReportPath(NextJobIndex)),
+				true, true, true, nullptr, 0, nullptr, nullptr);
+			if (Handle.IsValid())
+			{
+				RunningJobs.Add({ NextJobIndex, Handle, FPlatformTime::Seconds() });
+			}
+			else
+			{
+				UE_LOG(LogCustomLightingBuild, Error, TEXT("Failed to launch lighting build for %s %s"), *Job.Map, *Job.Scenario);
+				ReportLines.Add(GetReportLine(Job, { TEXT("LaunchFailed") }));
+				NumFailed++;
+			}
+			NextJobIndex++;
+		}
+
+		for (int32 Index = RunningJobs.Num() - 1; Index >= 0; --Index)
+		{
+			FRunningJob& Running = RunningJobs[Index];
+			if (FPlatformProcess::IsProcRunning(Running.Handle)) continue;
+
+			int32 ReturnCode = -1;
+			FPlatformProcess::GetProcReturnCode(Running.Handle, &ReturnCode);
+			FPlatformProcess::CloseProc(Running.Handle);
+
+			const FJob& Job = Jobs[Running.JobIndex];
+			UE_LOG(LogCustomLightingBuild, Display, TEXT("Lighting build for %s %s finished in %.1fs with code %d"),
+				*Job.Map, *Job.Scenario, FPlatformTime::Seconds() - Running.StartTime, ReturnCode);
+			if (ReturnCode != 0) NumFailed++;
+
+			// Skip the header of the child report
+			TArray<FString> ChildLines;
+			const FString ChildReportPath = GetJobReportPath(Running.JobIndex);
+			if (FFileHelper::LoadFileToStringArray(ChildLines, *ChildReportPath) && ChildLines.Num() > 1)
+			{
+				ReportLines.Append(&ChildLines[1], ChildLines.Num() - 1);
+			}
+			else
+			{
+				ReportLines.Add(GetReportLine(Job, { TEXT("Crashed") }));
+			}
+			IFileManager::Get().Delete(*ChildReportPath);
+
+			RunningJobs.RemoveAtSwap(Index);
+		}
+
+		FPlatformProcess::Sleep(0.5f);
+	}
+
+	FFileHelper::SaveStringArrayToFile(ReportLines, *ReportPath);
+
+	UE_LOG(LogCustomLightingBuild, Display, TEXT("%d of %d lighting builds succeeded, report written to %s"), Jobs.Num() - NumFailed, Jobs.Num(), *ReportPath);
+	return NumFailed ? 1 : 0;
+}
+
+bool UCustomLightingBuildCommandlet::RunJob(const FJob& Job, FJobReport& Report)
+{
+	double StartTime = FPlatformTime::Seconds();
+
+	FString PackageName;
+	if (!FPackageName::SearchForPackageOnDisk(Job.Map, &PackageName))
+	{
+		UE_LOG(LogCustomLightingBuild, Error, TEXT("Map %s not found"), *Job.Map);
+		Report.Status = TEXT("MapNotFound");
+		return false;
+	}
+
+	UPackage* Package = LoadPackage(nullptr, *PackageName, LOAD_None);
+	UWorld* World = Package ? UWorld::FindWorldInPackage(Package) : nullptr;
+	if (!World)
+	{
+		UE_LOG(LogCustomLightingBuild, Error, TEXT("Failed to load map %s"), *PackageName);
+		Report.Status = TEXT("LoadFailed");
+		return false;
+	}
+
+	World->AddToRoot();
+	UWorld::InitializationValues IVS;
+	IVS.RequiresHitProxies(false);
+	IVS.ShouldSimulatePhysics(false);
+	IVS.EnableTraceCollision(false);
+	IVS.CreateNavigation(false);
+	IVS.CreateAISystem(false);
+	IVS.AllowAudioPlayback(false);
+	IVS.CreatePhysicsScene(true);
+	World->InitWorld(IVS);
+	World->PersistentLevel->UpdateModelComponents();
+	World->UpdateWorldComponents(true, false);
+
+	UWorld* PrevWorld = GWorld;
+	GWorld = World;
+
+	// Everything has to be loaded & visible, except the lighting scenarios we're not building
+	World->LoadSecondaryLevels(true);
+	World->FlushLevelStreaming(EFlushLevelStreamingType::Full);
+
+	ULevel* LightingScenario = nullptr;
+	for (ULevelStreaming* StreamingLevel : World->GetStreamingLevels())
+	{
+		ULevel* Level = StreamingLevel ? StreamingLevel->GetLoadedLevel() : nullptr;
+		if (!Level) continue;
+
+		bool bVisible = true;
+		if (Level->bIsLightingScenario)
+		{
+			bVisible = FPackageName::GetShortName(Level->GetOutermost()) == Job.Scenario;
+			if (bVisible) LightingScenario = Level;
+		}
+		EditorLevelUtils::SetLevelVisibility(Level, bVisible, false);
+	}
+
+	Report.LoadTime = FPlatformTime::Seconds() - StartTime;
+	StartTime = FPlatformTime::Seconds();
+
+	bool bSuccessful = !Job.Scenario.IsEmpty() ? LightingScenario != nullptr : true;
+	if (!bSuccessful)
+	{
+		UE_LOG(LogCustomLightingBuild, Error, TEXT("Lighting scenario %s not found in %s"), *Job.Scenario, *PackageName);
+		Report.Status = TEXT("ScenarioNotFound");
+	}
+	else
+	{
+		UE_LOG(LogCustomLightingBuild, Display, TEXT("Building lighting for %s %s"), *PackageName, *Job.Scenario);
+
+		// The other shards load their maps in the meantime, and wait for this one to fill the Swarm cache
+		FString JobShardDir = ShardDir;
+		TArray<FProcHandle> ShardProcesses;
+		if (NumShards > 1 && ShardDir.IsEmpty())
+		{
+			JobShardDir = FPaths::ProjectIntermediateDir() / TEXT("CustomLightingShards") / FGuid::NewGuid().ToString();
+			ShardProcesses = LaunchShards(Job, JobShardDir);
+			Report.NumShards = NumShards;
+		}
+		const FString ExportedMarkerPath = JobShardDir / TEXT("Exported");
+		if (ShardIndex > 0)
+		{
+			while (!IFileManager::Get().FileExists(*ExportedMarkerPath) && FPlatformProcess::IsApplicationRunning(ShardParentId))
+			{
+				FPlatformProcess::Sleep(0.5f);
+			}
+		}
+
+		// Only builds that applied their lighting count, failed & canceled ones may have invalidated the levels already
+		bool bBuilt = false;
+		const FDelegateHandle BuildFinishedHandle = FCustomStaticLightingSystem::OnBuildFinished().AddLambda(
+			[&bBuilt](const FCustomStaticLightingSystem&, bool bSuccessful) { bBuilt = bSuccessful; });
+		const FDelegateHandle ExportFinishedHandle = FCustomStaticLightingSystem::OnExportFinished().AddLambda(
+			[&ShardProcesses, &ExportedMarkerPath](const FCustomStaticLightingSystem&)
+			{
+				if (ShardProcesses.Num()) FFileHelper::SaveStringToFile(FString(), *ExportedMarkerPath);
+			});
+
+		FCustomStaticLightingSystem* System = GetSystemFactories()[SystemName](Options, World, LightingScenario);
+		if (NumShards > 1)
+		{
+			System->SetShard(ShardIndex, NumShards);
+		}
+		if (FStaticLightingManager::Get()->LaunchCustomSystem(System))
+		{
+			while (GEditor->IsLightingBuildCurrentlyRunning())
+			{
+				GEditor->UpdateBuildLighting();
+				FPlatformProcess::Sleep(0.01f);
+			}
+		}
+		FCustomStaticLightingSystem::OnBuildFinished().Remove(BuildFinishedHandle);
+		FCustomStaticLightingSystem::OnExportFinished().Remove(ExportFinishedHandle);
+
+		bSuccessful = bBuilt && !GEditor->GetMapBuildCancelled();
+		if (!bSuccessful)
+		{
+			Report.Status = GEditor->GetMapBuildCancelled() ? TEXT("Canceled") : TEXT("BuildFailed");
+		}
+
+		if (ShardProcesses.Num())
+		{
+			// Shards that never saw an export, e.g. of an in-process build, do their own
+			if (!IFileManager::Get().FileExists(*ExportedMarkerPath))
+			{
+				FFileHelper::SaveStringToFile(FString(), *ExportedMarkerPath);
+			}
+
+			for (int32 Shard = 1; Shard < NumShards; ++Shard)
+			{
+				FProcHandle& Handle = ShardProcesses[Shard - 1];
+				// No point in waiting for the rest once one failed
+				if (!bSuccessful && Handle.IsValid())
+				{
+					FPlatformProcess::TerminateProc(Handle, true);
+				}
+				int32 ReturnCode = -1;
+				if (Handle.IsValid())
+				{
+					FPlatformProcess::WaitForProc(Handle);
+					FPlatformProcess::GetProcReturnCode(Handle, &ReturnCode);
+					FPlatformProcess::CloseProc(Handle);
+				}
+				if (bSuccessful && ReturnCode != 0)
+				{
+					UE_LOG(LogCustomLightingBuild, Error, TEXT("Lighting shard %d/%d of %s %s failed with code %d"), Shard + 1, NumShards, *PackageName, *Job.Scenario, ReturnCode);
+					Report.Status = TEXT("ShardFailed");
+					bSuccessful = false;
+				}
+			}
+
+			if (bSuccessful && !MergeShards(World, LightingScenario, JobShardDir))
+			{
+				Report.Status = TEXT("MergeFailed");
+				bSuccessful = false;
+			}
+			IFileManager::Get().DeleteDirectory(*JobShardDir, false, true);
+		}
+
+		Report.BuildTime = FPlatformTime::Seconds() - StartTime;
+		StartTime = FPlatformTime::Seconds();
+
+		if (!bSuccessful)
+		{
+			UE_LOG(LogCustomLightingBuild, Error, TEXT("Lighting build for %s %s failed, nothing saved"), *PackageName, *Job.Scenario);
+		}
+		else if (ShardIndex > 0)
+		{
+			// Merged & saved by shard 0
+			bSuccessful = SaveShardBuildData(World, LightingScenario);
+			Report.SaveTime = FPlatformTime::Seconds() - StartTime;
+			Report.Status = bSuccessful ? TEXT("Succeeded") : TEXT("SaveFailed");
+		}
+		else
+		{
+			if (NumShards > 1)
+			{
+				if (const double* Baseline = BaselineBuildTimes.Find(Job.Map + TEXT(",") + Job.Scenario))
+				{
+					Report.SpeedUp = *Baseline / FMath::Max(Report.BuildTime, 0.001);
+					UE_LOG(LogCustomLightingBuild, Display, TEXT("%d lighting shards of %s %s built in %.1fs, %.2fx the speed of a single job (%.1fs)"),
+						NumShards, *PackageName, *Job.Scenario, Report.BuildTime, Report.SpeedUp, *Baseline);
+				}
+				else
+				{
+					UE_LOG(LogCustomLightingBuild, Display, TEXT("%d lighting shards of %s %s built in %.1fs, no single job in %s to compare with"),
+						NumShards, *PackageName, *Job.Scenario, Report.BuildTime, *ReportPath);
+				}
+			}
+
+			TArray<UPackage*> PackagesToSave;
+			for (ULevel* Level : World->GetLevels())
+			{
+				if (Level->GetOutermost()->IsDirty())
+				{
+					PackagesToSave.AddUnique(Level->GetOutermost());
+				}
+				if (Level->MapBuildData && Level->MapBuildData->GetOutermost()->IsDirty())
+				{
+					PackagesToSave.AddUnique(Level->MapBuildData->GetOutermost());
+				}
+			}
+
+			bSuccessful = SavePackagesWithConsistentGuid(PackagesToSave);
+			Report.SaveTime = FPlatformTime::Seconds() - StartTime;
+			Report.Status = bSuccessful ? TEXT("Succeeded") : TEXT("SaveFailed");
+		}
+	}
+
+	GWorld = PrevWorld;
+	World->ClearWorldComponents();
+	World->CleanupWorld();
+	World->RemoveFromRoot();
+	CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+
+	return bSuccessful;
+}
+
+FString UCustomLightingBuildCommandlet::GetReportHeader()
+{
+	return TEXT("Map,Scenario,Status,LoadSeconds,BuildSeconds,SaveSeconds,Shards,SpeedUp");
+}
+
+FString UCustomLightingBuildCommandlet::GetReportLine(const FJob& Job, const FJobReport& Report)
+{
+	return FString::Printf(TEXT("%s,%s,%s,%.2f,%.2f,%.2f,%d,%.2f"), *Job.Map, *Job.Scenario, *Report.Status,
+		Report.LoadTime, Report.BuildTime, Report.SaveTime, Report.NumShards, Report.SpeedUp);
+}
+
+TArray<FProcHandle> UCustomLightingBuildCommandlet::LaunchShards(const FJob& Job, const FString& JobShardDir) const
+{
+	IFileManager::Get().MakeDirectory(*JobShardDir, true);
+
+	TArray<FProcHandle> Handles;
+	for (int32 Shard = 1; Shard < NumShards; ++Shard)
+	{
+		const FString Params = GetChildParams(Job, JobShardDir / FString::Printf(TEXT("%d.csv"), Shard))
+			+ FString::Printf(TEXT(" -Shards=%d -Shard=%d -ShardDir=\"%s\" -ShardParent=%u"), NumShards, Shard, *JobShardDir, FPlatformProcess::GetCurrentProcessId());
+		Handles.Add(FPlatformProcess::CreateProc(FPlatformProcess::ExecutablePath(), *Params, true, true, true, nullptr, 0, nullptr, nullptr));
+		if (!Handles.Last().IsValid())
+		{
+			UE_LOG(LogCustomLightingBuild, Error, TEXT("Failed to launch lighting shard %d/%d of %s %s"), Shard + 1, NumShards, *Job.Map, *Job.Scenario);
+		}
+	}
+	return Handles;
+}
+
+bool UCustomLightingBuildCommandlet::SaveShardBuildData(UWorld* World, ULevel* LightingScenario) const
+{
+	// Saved next to each other instead of over the real packages, shard 0 merges what belongs to this shard
+	bool bSuccessful = true;
+	for (UMapBuildDataRegistry* Registry : GetBuildDataRegistries(World, LightingScenario))
+	{
+		UPackage* Package = Registry->GetOutermost();
+		const FString Filename = GetShardBuildDataPath(ShardDir, ShardIndex, Package->GetName());
+#if UE_VERSION_OLDER_THAN(5, 0, 0)
+		bSuccessful &= SavePackageHelper(Package, Filename, RF_Standalone, GWarn, nullptr, SAVE_KeepGUID);
+#else
+		bSuccessful &= SavePackageHelper(Package, Filename, RF_Standalone, GWarn, SAVE_KeepGUID);
+#endif
+	}
+	return bSuccessful;
+}
+
+bool UCustomLightingBuildCommandlet::MergeShards(UWorld* World, ULevel* LightingScenario, const FString& JobShardDir) const
+{
+	// Loaded under temporary names, the real packages are in memory already
+	TMap<TPair<int32, FString>, UMapBuildDataRegistry*> ShardRegistries;
+	auto FindShardRegistry = [&ShardRegistries, &JobShardDir](int32 Shard, const UPackage* Package)
+	{
+		const TPair<int32, FString> Key(Shard, Package->GetName());
+		if (UMapBuildDataRegistry** Found = ShardRegistries.Find(Key))
+		{
+			return *Found;
+		}
+
+		UMapBuildDataRegistry* Registry = nullptr;
+		const FString Filename = GetShardBuildDataPath(JobShardDir, Shard, Package->GetName());
+		UPackage* ShardPackage = CreatePackage(*FString::Printf(TEXT("/Temp/CustomLightingShard%d/%s"), Shard, *FPackageName::GetShortName(Package)));
+		if (IFileManager::Get().FileExists(*Filename) && LoadPackage(ShardPackage, *Filename, LOAD_ForDiff | LOAD_DisableCompileOnLoad))
+		{
+			ForEachObjectWithOuter(ShardPackage, [&Registry](UObject* Object)
+			{
+				if (!Registry) Registry = Cast<UMapBuildDataRegistry>(Object);
+			}, false);
+		}
+		return ShardRegistries.Add(Key, Registry);
+	};
+
+	int32 NumMerged = 0;
+	bool bComplete = true;
+	TSet<UMapBuildDataRegistry*> MergedRegistries;
+	for (ULevel* Level : World->GetLevels())
+	{
+		ULevel* DataLevel = LightingScenario ? LightingScenario : Level;
+		for (AActor* Actor : Level->Actors)
+		{
+			if (!Actor) continue;
+
+			TInlineComponentArray<UPrimitiveComponent*> Primitives(Actor);
+			for (UPrimitiveComponent* Primitive : Primitives)
+			{
+				// Shard 0 is what this process just built
+				const int32 Shard = FCustomStaticLightingSystem::GetPrimitiveShard(Primitive->GetPathName(), NumShards);
+				if (Shard == 0) continue;
+
+				TSet<FGuid> Guids;
+				Primitive->AddMapBuildDataGUIDs(Guids);
+				if (Guids.Num() == 0) continue;
+
+				UMapBuildDataRegistry* Target = DataLevel->GetOrCreateMapBuildData();
+				const UMapBuildDataRegistry* Source = FindShardRegistry(Shard, Target->GetOutermost());
+				if (!Source)
+				{
+					UE_LOG(LogCustomLightingBuild, Error, TEXT("No build data of lighting shard %d/%d for %s"), Shard + 1, NumShards, *Target->GetOutermost()->GetName());
+					bComplete = false;
+					continue;
+				}
+
+				for (const FGuid& Guid : Guids)
+				{
+					const FMeshMapBuildData* Data = Source->GetMeshBuildData(Guid);
+					if (!Data) continue;
+
+					FMeshMapBuildData& Merged = Target->AllocateMeshBuildData(Guid, true);
+					Merged = *Data;
+					NumMerged++;
+
+					// Textures are shared by the entries of their atlas, each is moved over with the first one
+					FShardBuildDataCollector Collector(Source->GetOutermost());
+					Merged.AddReferencedObjects(Collector);
+					for (UObject* Object : Collector.Objects)
+					{
+						UObject* NewOuter = Object->GetOuter() == Source ? static_cast<UObject*>(Target) : Target->GetOutermost();
+						Object->Rename(*MakeUniqueObjectName(NewOuter, Object->GetClass(), Object->GetFName()).ToString(), NewOuter,
+							REN_DontCreateRedirectors | REN_NonTransactional | REN_DoNotDirty | REN_ForceNoResetLoaders);
+					}
+				}
+				MergedRegistries.Add(Target);
+			}
+		}
+	}
+
+	// Clusters of the merged entries still point into the shard registries
+	for (UMapBuildDataRegistry* Registry : MergedRegistries)
+	{
+		Registry->SetupLightmapResourceClusters();
+	}
+
+	UE_LOG(LogCustomLightingBuild, Display, TEXT("Merged %d mesh build data entries from %d lighting shards"), NumMerged, NumShards - 1);
+	return bComplete;
+}
@@ -5,7 +5,9 @@
 
 #include "ISourceControlModule.h"
 #include "PackageHelperFunctions.h"
-#include "SourceControlHelpers.h"
+#include "SourceControlOperations.h"
+#include "Async/ParallelFor.h"
+#include "Engine/Engine.h"
 #include "Engine/LevelBounds.h"
 
 #if UE_VERSION_NEWER_THAN(5, 1, 0)
@@ -31,73 +33,301 @@ static FWorldTileInfo* GetWorldTileInfo(UPackage* Package)
 #endif
 }
 
+static bool BoxesNearlyEqual(const FBox& A, const FBox& B, float Tolerance)
+{
+	if (A.IsValid != B.IsValid) return false;
+	return !A.IsValid || (A.Min.Equals(B.Min, Tolerance) && A.Max.Equals(B.Max, Tolerance));
+}
+
+static bool UpdateWorldTileInfo(FWorldTileInfo& TileInfo, const FBox& WorldBounds, float Tolerance)
+{
+	FVector WorldPosition(int32(WorldBounds.GetCenter().X), int32(WorldBounds.GetCenter().Y), 0.f);
+	FVector WorldPositionParent(0.f, 0.f, 0.f);
+
+	FVector LocalPosition = WorldPosition - WorldPositionParent;
+	FBox LocalBounds = WorldBounds.ShiftBy(-WorldPosition);
+
+	FIntVector AbsolutePosition(WorldPosition.X, WorldPosition.Y, WorldPosition.Z);
+	FIntVector Position(LocalPosition.X, LocalPosition.Y, LocalPosition.Z);
+
+	if (BoxesNearlyEqual(TileInfo.Bounds, LocalBounds, Tolerance) &&
+		TileInfo.AbsolutePosition == AbsolutePosition && TileInfo.Position == Position)
+	{
+		return false;
+	}
+
+	TileInfo.Bounds = LocalBounds;
+	TileInfo.AbsolutePosition = AbsolutePosition;
+	TileInfo.Position = Position;
+	return true;
+}
+
 void UpdateLevelBounds(ULevel* Level)
 {
-	ALevelBounds* LevelBounds = Level->LevelBoundsActor.Get();
-	if (!LevelBounds)
+	UpdateLevelBounds(MakeArrayView(&Level, 1));
+}
+
+TArray<UPackage*> UpdateLevelBounds(TArrayView<ULevel* const> Levels, float Tolerance)
+{
+	// Spawning has to happen on the game thread, before anything else
+	TArray<ALevelBounds*> LevelBoundsActors;
+	TBitArray<> NewlySpawned(false, Levels.Num());
+	LevelBoundsActors.Reserve(Levels.Num());
+	for (int32 Index = 0; Index < Levels.Num(); ++Index)
 	{
-		FActorSpawnParameters SpawnParameters;
-		SpawnParameters.OverrideLevel = Level;
-		LevelBounds = Level->GetWorld()->SpawnActor<ALevelBounds>(SpawnParameters);
-		Level->LevelBoundsActor = LevelBounds;
+		ULevel* Level = Levels[Index];
+		ALevelBounds* LevelBounds = Level->LevelBoundsActor.Get();
+		if (!LevelBounds)
+		{
+			FActorSpawnParameters SpawnParameters;
+			SpawnParameters.OverrideLevel = Level;
+			LevelBounds = Level->GetWorld()->SpawnActor<ALevelBounds>(SpawnParameters);
+			Level->LevelBoundsActor = LevelBounds;
+			NewlySpawned[Index] = true;
+		}
+		LevelBoundsActors.Add(LevelBounds);
 	}
-	LevelBounds->UpdateLevelBoundsImmediately();
 
-	if (UPackage* Package = Level->GetPackage())
+	// Only the cached component bounds are read, nothing is written while the game thread waits on ParallelFor
+	constexpr int32 ActorsPerTask = 256;
+	TArray<FBox> ComputedBounds;
+	ComputedBounds.Init(FBox(ForceInit), Levels.Num());
+	for (int32 Index = 0; Index < Levels.Num(); ++Index)
 	{
-		FBox WorldBounds = LevelBounds->GetComponentsBoundingBox();
-		FVector WorldPosition(int32(WorldBounds.GetCenter().X), int32(WorldBounds.GetCenter().Y), 0.f);
-		FVector WorldPositionParent(0.f, 0.f, 0.f);
+		const auto& Actors = Levels[Index]->Actors;
+		TArray<FBox> TaskBounds;
+		TaskBounds.Init(FBox(ForceInit), FMath::DivideAndRoundUp(Actors.Num(), ActorsPerTask));
+		ParallelFor(TaskBounds.Num(), [&](int32 Task)
+		{
+			const int32 End = FMath::Min((Task + 1) * ActorsPerTask, Actors.Num());
+			for (int32 ActorIndex = Task * ActorsPerTask; ActorIndex < End; ++ActorIndex)
+			{
+				const AActor* Actor = Actors[ActorIndex];
+				if (Actor && Actor->IsLevelBoundsRelevant())
+				{
+					TaskBounds[Task] += Actor->GetComponentsBoundingBox(true);
+				}
+			}
+		});
+		for (const FBox& Box : TaskBounds) ComputedBounds[Index] += Box;
+	}
 
-		FVector LocalPosition = WorldPosition - WorldPositionParent;
-		FBox LocalBounds = WorldBounds.ShiftBy(-WorldPosition);
+	TArray<UPackage*> ChangedPackages;
+	for (int32 Index = 0; Index < Levels.Num(); ++Index)
+	{
+		ULevel* Level = Levels[Index];
+		ALevelBounds* LevelBounds = LevelBoundsActors[Index];
+		const FBox& Bounds = ComputedBounds[Index];
 
-		GetWorldTileInfo(Package)->Bounds = LocalBounds;
-		GetWorldTileInfo(Package)->AbsolutePosition = FIntVector(WorldPosition.X, WorldPosition.Y, WorldPosition.Z);
-		GetWorldTileInfo(Package)->Position = FIntVector(LocalPosition.X, LocalPosition.Y, LocalPosition.Z);
+		if (!Bounds.IsValid || LevelBounds->IsUsingDefaultBounds())
+		{
+			// Falls back to a default extent, or leaves it, only ALevelBounds itself can update that flag
+			LevelBounds->UpdateLevelBoundsImmediately();
+		}
+		else if (NewlySpawned[Index] || !BoxesNearlyEqual(LevelBounds->GetComponentsBoundingBox(), Bounds, Tolerance))
+		{
+			// Same as ALevelBounds::UpdateLevelBounds, without going through every actor again
+			LevelBounds->SetActorTransform(FTransform(FQuat::Identity, Bounds.GetCenter(), Bounds.GetSize()));
+			Level->BroadcastLevelBoundsActorUpdated();
+		}
 
-		(void)Level->MarkPackageDirty();
+		UPackage* Package = Level->GetPackage();
+		FWorldTileInfo* TileInfo = GetWorldTileInfo(Package);
+		if (TileInfo && UpdateWorldTileInfo(*TileInfo, LevelBounds->GetComponentsBoundingBox(), Tolerance))
+		{
+			(void)Level->MarkPackageDirty();
+			ChangedPackages.Add(Package);
+		}
+	}
+	return ChangedPackages;
+}
+
+FLevelActorIndex& FLevelActorIndex::Get()
+{
+	static FLevelActorIndex Instance;
+	return Instance;
+}
+
+FLevelActorIndex::FLevelActorIndex()
+{
+	// The index lives until shutdown, no need to unregister
+	GEngine->OnLevelActorAdded().AddRaw(this, &FLevelActorIndex::OnLevelActorAdded);
+	GEngine->OnLevelActorDeleted().AddRaw(this, &FLevelActorIndex::OnLevelActorDeleted);
+}
+
+AActor* FLevelActorIndex::Find(ULevel* Level, const UClass* Class)
+{
+	check(IsInGameThread());
+	if (!Level) return nullptr;
+
+	FLevelEntry& Entry = FindOrBuildEntry(Level);
+	if (const TWeakObjectPtr<AActor>* Actor = Entry.Actors.Find(Class))
+	{
+		if (Actor->IsValid() && (*Actor)->GetLevel() == Level)
+		{
+			return Actor->Get();
+		}
+
+		// Something slipped past the notifications, start over
+		Levels.Remove(Level);
+		return FindOrBuildEntry(Level).Actors.FindRef(Class).Get();
+	}
+	return nullptr;
+}
+
+void FLevelActorIndex::Invalidate(const ULevel* Level)
+{
+	if (Level)
+	{
+		Levels.Remove(Level);
+	}
+	else
+	{
+		Levels.Empty();
+	}
+}
+
+FLevelActorIndex::FLevelEntry& FLevelActorIndex::FindOrBuildEntry(ULevel* Level)
+{
+	FLevelEntry* Entry = Levels.Find(Level);
+
+	// Actors added without notification (e.g. outside the editor) still grow the array
+	if (Entry && Entry->NumLevelActors != Level->Actors.Num())
+	{
+		Entry = nullptr;
+	}
+
+	if (!Entry)
+	{
+		// Drop stale levels while we're at it
+		for (auto It = Levels.CreateIterator(); It; ++It)
+		{
+			if (!It.Key().IsValid()) It.RemoveCurrent();
+		}
+
+		Entry = &Levels.Add(Level);
+		for (AActor* Actor : Level->Actors)
+		{
+			AddActor(*Entry, Actor);
+		}
+		Entry->NumLevelActors = Level->Actors.Num();
+	}
+	return *Entry;
+}
+
+void FLevelActorIndex::AddActor(FLevelEntry& Entry, AActor* Actor)
+{
+	if (!IsValid(Actor)) return;
+
+	// Register under every class up the hierarchy so lookups match the semantics of Cast
+	for (const UClass* Class = Actor->GetClass(); Class && Class != AActor::StaticClass(); Class = Class->GetSuperClass())
+	{
+		TWeakObjectPtr<AActor>& Slot = Entry.Actors.FindOrAdd(Class);
+		if (Slot.IsValid()) break; // Super classes are taken too
+		Slot = Actor;
+	}
+}
+
+void FLevelActorIndex::OnLevelActorAdded(AActor* Actor)
+{
+	ULevel* Level = Actor ? Actor->GetLevel() : nullptr;
+	if (FLevelEntry* Entry = Level ? Levels.Find(Level) : nullptr)
+	{
+		AddActor(*Entry, Actor);
+		Entry->NumLevelActors = Level->Actors.Num();
+	}
+}
+
+void FLevelActorIndex::OnLevelActorDeleted(AActor* Actor)
+{
+	if (ULevel* Level = Actor ? Actor->GetLevel() : nullptr)
+	{
+		Levels.Remove(Level);
 	}
 }
 
 class FSourceControlHelper
 {
 public:
-	FSourceControlHelper()
+	explicit FSourceControlHelper(ISourceControlProvider& InProvider)
+		: Provider(InProvider)
 	{
-		auto& SourceControlProvider = ISourceControlModule::Get().GetProvider();
-		SourceControlProvider.Init();
-		bActive = SourceControlProvider.IsEnabled();
+		Provider.Init();
+		bActive = Provider.IsEnabled();
 	}
 
-	void Checkout(const FString& FilePath) const
+	void Checkout(const TArray<FString>& FilePaths) const
 	{
-		if (bActive)
-		{
-			const FSourceControlState State = USourceControlHelpers::QueryFileState(FilePath);
+		if (!bActive || FilePaths.Num() == 0) return;
+
+		// One round trip for all the states, and another one for all the checkouts
+		Provider.Execute(ISourceControlOperation::Create<FUpdateStatus>(), FilePaths);
+
+		TArray<FSourceControlStateRef> States;
+		Provider.GetState(FilePaths, States, EStateCacheUsage::Use);
 
-			if (State.bIsSourceControlled && !State.bIsCheckedOut && !State.bIsAdded && State.bCanCheckOut)
+		TArray<FString> FilesToCheckout;
+		for (const FSourceControlStateRef& State : States)
+		{
+			if (State->IsSourceControlled() && !State->IsCheckedOut() && !State->IsAdded() && State->CanCheckout())
 			{
-				USourceControlHelpers::CheckOutFile(FilePath);
+				FilesToCheckout.Add(State->GetFilename());
 			}
 		}
+
+		if (FilesToCheckout.Num())
+		{
+			Provider.Execute(ISourceControlOperation::Create<FCheckOut>(), FilesToCheckout);
+		}
 	}
 
 private:
+	ISourceControlProvider& Provider;
 	bool bActive;
 };
 
+static FString GetPackageFileName(const UPackage* Package)
+{
+	FString FileName;
+	const FString& Extension = Package->ContainsMap() ? FPackageName::GetMapPackageExtension() : FPackageName::GetAssetPackageExtension();
+	ensure(FPackageName::TryConvertLongPackageNameToFilename(Package->GetPathName(), FileName, Extension));
+	return FileName;
+}
+
 void SavePackageWithConsistentGuid(UPackage* Package)
 {
-	static FSourceControlHelper SourceControlHelper;
+	SavePackagesWithConsistentGuid(MakeArrayView(&Package, 1));
+}
+
+bool SavePackagesWithConsistentGuid(TArrayView<UPackage* const> Packages, ISourceControlProvider* Provider)
+{
+	TArray<FString> FileNames;
+	FileNames.Reserve(Packages.Num());
+	for (const UPackage* Package : Packages)
+	{
+		FileNames.Add(GetPackageFileName(Package));
+	}
 
-	FString LevelFileName;
-	ensure(FPackageName::TryConvertLongPackageNameToFilename(Package->GetPathName(), LevelFileName, FPackageName::GetMapPackageExtension()));
-	SourceControlHelper.Checkout(LevelFileName);
+	if (Provider)
+	{
+		FSourceControlHelper(*Provider).Checkout(FileNames);
+	}
+	else
+	{
+		// Only initialize the module provider once somebody actually needs it
+		static FSourceControlHelper DefaultSourceControlHelper(ISourceControlModule::Get().GetProvider());
+		DefaultSourceControlHelper.Checkout(FileNames);
+	}
 
+	// Map packages can't be saved concurrently outside of the cooker, so this part stays serial
+	bool bSuccessful = true;
+	for (int32 Index = 0; Index < Packages.Num(); ++Index)
+	{
 #if UE_VERSION_OLDER_THAN(5, 0, 0)
-	SavePackageHelper(Package, LevelFileName, RF_Standalone, GWarn, nullptr, SAVE_KeepGUID);
+		bSuccessful &= SavePackageHelper(Packages[Index], FileNames[Index], RF_Standalone, GWarn, nullptr, SAVE_KeepGUID);
 #else
-	SavePackageHelper(Package, LevelFileName, RF_Standalone, GWarn, SAVE_KeepGUID);
+		bSuccessful &= SavePackageHelper(Packages[Index], FileNames[Index], RF_Standalone, GWarn, SAVE_KeepGUID);
 #endif
+	}
+	return bSuccessful;
 }
@@ -3,22 +3,36 @@
 
 #include "ExtensibilityUnrealEd.h"
 
+#include "Editor.h"
+#include "Async/Async.h"
 #include "Dom/JsonObject.h"
+#include "Framework/Application/SlateApplication.h"
+#include "Framework/Notifications/NotificationManager.h"
+#include "Hash/CityHash.h"
 #include "HAL/FileManager.h"
+#include "Math/GenericOctree.h"
 #include "Misc/EngineBuildSettings.h"
+#include "Misc/LightmassCustomDataHeader.h"
 #include "Misc/PrivateAccessor.h"
+#include "Serialization/ArchiveObjectCrc32.h"
 #include "Serialization/JsonReader.h"
 #include "Serialization/JsonSerializer.h"
+#include "Serialization/MemoryReader.h"
 #include "StaticLightingSystem/StaticLightingPrivate.h"
+#include "Widgets/Notifications/SNotificationList.h"
 
 #define LOCTEXT_NAMESPACE "Lightmass"
 
-void FStaticLightingManager::LaunchCustomSystem(FStaticLightingSystem* CustomSystem)
+extern FLightmassDebugOptions GLightmassDebugOptions;
+
+bool FStaticLightingManager::LaunchCustomSystem(FStaticLightingSystem* CustomSystem)
 {
 	if (StaticLightingSystems.Num() == 0)
 	{
 		check(!ActiveStaticLightingSystem);
 
+		// Left over from whatever build was canceled last
+		GEditor->SetMapBuildCancelled(false);
 		bBuildReflectionCapturesOnFinish = false;
 		StaticLightingSystems.Emplace(CustomSystem);
 		ActiveStaticLightingSystem = StaticLightingSystems[0].Get();
@@ -32,6 +46,7 @@ void FStaticLightingManager::LaunchCustomSystem(FStaticLightingSystem* CustomSys
 			if (ActiveStaticLightingSystem->BeginLightmassProcess())
 			{
 				SendProgressNotification();
+				return true;
 			}
 			else
 			{
@@ -63,6 +78,145 @@ void FStaticLightingManager::LaunchCustomSystem(FStaticLightingSystem* CustomSys
 		}
 		delete CustomSystem;
 	}
+	return false;
+}
+
+FCustomStaticLightingQueue& FCustomStaticLightingQueue::Get()
+{
+	static FCustomStaticLightingQueue Instance;
+	return Instance;
+}
+
+FCustomStaticLightingQueue::FCustomStaticLightingQueue()
+{
+	// The queue lives until shutdown, no need to unregister
+	FCustomStaticLightingSystem::OnBuildFinished().AddRaw(this, &FCustomStaticLightingQueue::OnBuildFinished);
+}
+
+void FCustomStaticLightingQueue::OnBuildFinished(const FCustomStaticLightingSystem& System, bool bSuccessful)
+{
+	// Only compared, the system may well be gone by the time the queue ticks again
+	if (&System == ActiveSystem)
+	{
+		bActiveBuildSucceeded = bSuccessful;
+	}
+}
+
+int32 FCustomStaticLightingQueue::Enqueue(FCustomStaticLightingSystem* System, const FText& DisplayName)
+{
+	check(IsInGameThread() && System);
+
+	const int32 BuildId = NextBuildId++;
+	PendingBuilds.Add({ BuildId, DisplayName.IsEmpty() ? FText::AsNumber(BuildId) : DisplayName, TUniquePtr<FCustomStaticLightingSystem>(System) });
+	BuildStateChanged.Broadcast(BuildId, EBuildState::Queued);
+
+	if (!TickerHandle.IsValid())
+	{
+		TickerHandle = UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FCustomStaticLightingQueue::Tick));
+	}
+
+	if (ActiveBuildId != INDEX_NONE || PendingBuilds.Num() > 1)
+	{
+		Notify(FText::Format(LOCTEXT("CustomLightBuildQueued", "Lighting build {0} queued ({1} pending)"), PendingBuilds.Last().DisplayName, PendingBuilds.Num()));
+	}
+	return BuildId;
+}
+
+bool FCustomStaticLightingQueue::Cancel(int32 BuildId)
+{
+	check(IsInGameThread());
+
+	if (IsActive(BuildId))
+	{
+		ActiveBuildId = INDEX_NONE;
+		ActiveSystem = nullptr;
+		FStaticLightingManager::CancelLightingBuild();
+		BuildStateChanged.Broadcast(BuildId, EBuildState::Canceled);
+		return true;
+	}
+
+	const int32 Index = PendingBuilds.IndexOfByPredicate([BuildId](const FPendingBuild& Build) { return Build.BuildId == BuildId; });
+	if (Index == INDEX_NONE) return false;
+
+	PendingBuilds.RemoveAt(Index);
+	BuildStateChanged.Broadcast(BuildId, EBuildState::Canceled);
+	return true;
+}
+
+void FCustomStaticLightingQueue::CancelAll()
+{
+	// Pending ones first so nothing gets launched in between
+	while (PendingBuilds.Num())
+	{
+		Cancel(PendingBuilds.Last().BuildId);
+	}
+	Cancel(ActiveBuildId);
+}
+
+bool FCustomStaticLightingQueue::Tick(float DeltaTime)
+{
+	const bool bBuilding = GEditor->IsLightingBuildCurrentlyRunning();
+
+	if (ActiveBuildId != INDEX_NONE && !bBuilding)
+	{
+		FinishActiveBuild();
+	}
+
+	// Someone else may have started a build in the meantime, just wait for it
+	if (ActiveBuildId == INDEX_NONE && !bBuilding && PendingBuilds.Num())
+	{
+		FPendingBuild Build = MoveTemp(PendingBuilds[0]);
+		PendingBuilds.RemoveAt(0);
+
+		if (PendingBuilds.Num())
+		{
+			Notify(FText::Format(LOCTEXT("CustomLightBuildStarted", "Starting lighting build {0} ({1} pending)"), Build.DisplayName, PendingBuilds.Num()));
+		}
+
+		ActiveBuildId = Build.BuildId;
+		ActiveSystem = Build.System.Get();
+		bActiveBuildSucceeded = false;
+		BuildStateChanged.Broadcast(ActiveBuildId, EBuildState::Started);
+		if (!FStaticLightingManager::Get()->LaunchCustomSystem(Build.System.Release()))
+		{
+			FinishActiveBuild();
+		}
+	}
+
+	if (ActiveBuildId == INDEX_NONE && PendingBuilds.Num() == 0)
+	{
+		TickerHandle.Reset();
+		return false;
+	}
+	return true;
+}
+
+void FCustomStaticLightingQueue::FinishActiveBuild()
+{
+	const int32 FinishedBuildId = ActiveBuildId;
+	const EBuildState State = bActiveBuildSucceeded ? EBuildState::Finished : GEditor->GetMapBuildCancelled() ? EBuildState::Canceled : EBuildState::Failed;
+	ActiveBuildId = INDEX_NONE;
+	ActiveSystem = nullptr;
+	BuildStateChanged.Broadcast(FinishedBuildId, State);
+}
+
+void FCustomStaticLightingQueue::Notify(const FText& Text) const
+{
+	if (IsRunningCommandlet() || !FSlateApplication::IsInitialized())
+	{
+		UE_LOG(LogStaticLightingSystem, Display, TEXT("%s"), *Text.ToString());
+		return;
+	}
+
+	FNotificationInfo Info(Text);
+	Info.ExpireDuration = 5.0f;
+	FSlateNotificationManager::Get().AddNotification(Info);
+}
+
+static TMap<FString, int64>& GetPluginMemoryBudgets()
+{
+	static TMap<FString, int64> Budgets;
+	return Budgets;
 }
 
 void FLightmassExporter::WriteCustomData(int32 Channel, bool bForceContentExport)
@@ -72,12 +226,19 @@ void FLightmassExporter::WriteCustomData(int32 Channel, bool bForceContentExport
 	// Subclass implementations should always begin with:
 	/*
 	DependentPluginModules = TEXT("YourPlugin:Module1 YourPlugin:Module2");
-	FLightmassExporter::WriteCustomData(Channel, bForceContentExport);
+	FCustomLightmassExporter::WriteCustomData(Channel, bForceContentExport);
 	*/
 
-	int32 NameLength = DependentPluginModules.GetCharArray().Num();
-	Swarm.WriteChannel(Channel, &NameLength, sizeof(NameLength));
-	Swarm.WriteChannel(Channel, *DependentPluginModules, NameLength * sizeof(TCHAR));
+	FLightmassCustomDataHeader Header;
+	Header.DependentPluginModules = DependentPluginModules;
+	for (const FString& Pair : Header.GetModules())
+	{
+		FString Plugin, Module;
+		Pair.Split(TEXT(":"), &Plugin, &Module);
+		const int64* Budget = GetPluginMemoryBudgets().Find(Module);
+		Header.MemoryBudgets.Add(Budget ? *Budget : 0);
+	}
+	Header.Write([this, Channel](const void* Data, int32 Size) { Swarm.WriteChannel(Channel, Data, Size); });
 }
 
 TSet<FString> FLightmassExporter::GetPluginBinaryDependencies(bool bIs64Bit, bool bIsOptional) const
@@ -167,8 +328,752 @@ FCustomStaticLightingSystem::FCustomStaticLightingSystem(const FLightingBuildOpt
 #else
 	: FStaticLightingSystem(InOptions, {InWorld, InLightingScenario})
 #endif
+	, CreationTime(FPlatformTime::Seconds())
+	, BuildDataLevel(InLightingScenario)
 {}
 
+void FCustomStaticLightingSystem::SetShard(int32 InShardIndex, int32 InNumShards)
+{
+	check(InNumShards > 0 && InShardIndex >= 0 && InShardIndex < InNumShards);
+	ShardIndex = InShardIndex;
+	NumShards = InNumShards;
+}
+
+bool FCustomStaticLightingSystem::IsInShard(const FGuid& Guid) const
+{
+	if (NumShards == 1) return true;
+
+	// Custom tasks keyed by any Guid of a primitive end up in the same shard as its mappings
+	if (const int32* Shard = GuidShards.Find(Guid))
+	{
+		return *Shard == ShardIndex;
+	}
+	return GetTypeHash(Guid) % NumShards == ShardIndex;
+}
+
+bool FCustomStaticLightingSystem::IsInShard(const UPrimitiveComponent* Primitive) const
+{
+	return NumShards == 1 || IsInShard(Primitive->GetPathName());
+}
+
+bool FCustomStaticLightingSystem::IsInShard(const FString& PrimitivePath) const
+{
+	return NumShards == 1 || GetPrimitiveShard(PrimitivePath, NumShards) == ShardIndex;
+}
+
+int32 FCustomStaticLightingSystem::GetPrimitiveShard(const FString& PrimitivePath, int32 InNumShards)
+{
+	return FCrc::StrCrc32(*PrimitivePath) % InNumShards;
+}
+
+bool FCustomStaticLightingSystem::CustomizePrimitiveInfo(UPrimitiveComponent* Primitive, FStaticLightingPrimitiveInfo& PrimitiveInfo)
+{
+	if (NumShards == 1)
+	{
+		NumShardMappings += PrimitiveInfo.Mappings.Num();
+		return true;
+	}
+
+	const int32 Shard = GetPrimitiveShard(Primitive->GetPathName(), NumShards);
+	for (const FStaticLightingMesh* Mesh : PrimitiveInfo.Meshes)
+	{
+		GuidShards.Add(Mesh->Guid, Shard);
+	}
+	TSet<FGuid> BuildDataGuids;
+	Primitive->AddMapBuildDataGUIDs(BuildDataGuids);
+	for (const FGuid& Guid : BuildDataGuids)
+	{
+		GuidShards.Add(Guid, Shard);
+	}
+
+	if (Shard == ShardIndex)
+	{
+		NumShardMappings += PrimitiveInfo.Mappings.Num();
+		return true;
+	}
+
+	// Meshes still take part in the scene, only the mappings are dropped
+	NumSkippedMappings += PrimitiveInfo.Mappings.Num();
+	for (FStaticLightingMapping* Mapping : PrimitiveInfo.Mappings)
+	{
+		TRefCountPtr<FStaticLightingMapping> Release(Mapping);
+	}
+	PrimitiveInfo.Mappings.Empty();
+	BuildDataResourcesToKeep.Append(BuildDataGuids);
+	return true;
+}
+
+void FCustomStaticLightingSystem::ApplyNewLightingData(bool bSuccessful)
+{
+	if (NumShards > 1)
+	{
+		UE_LOG(LogStaticLightingSystem, Log, TEXT("Lighting shard %d/%d: %d of %d mappings built in %.1fs"), ShardIndex + 1, NumShards,
+			NumShardMappings, NumShardMappings + NumSkippedMappings, FPlatformTime::Seconds() - CreationTime);
+	}
+	// Flush whatever completed since the last tick
+	if (StreamingTickerHandle.IsValid())
+	{
+		StreamCustomResults();
+		EndStreamingApply();
+	}
+	EndTelemetry();
+	if (!bInProcess)
+	{
+		ReadPluginMemoryReports();
+	}
+
+	FStaticLightingSystem::ApplyNewLightingData(bSuccessful);
+	OnBuildFinished().Broadcast(*this, bSuccessful);
+
+	// Only a successful build can be the baseline of the next one
+	if (bSuccessful && PendingIncrementalState.IsSet())
+	{
+		GetIncrementalStates().Add(GetIncrementalStateKey(), MoveTemp(PendingIncrementalState.GetValue()));
+	}
+	PendingIncrementalState.Reset();
+}
+
+void FCustomStaticLightingSystem::SetIncremental(bool bInIncremental, float InDependencyRadius)
+{
+	bIncremental = bInIncremental;
+	DependencyRadius = InDependencyRadius;
+}
+
+void FCustomStaticLightingSystem::ResetIncrementalStates()
+{
+	GetIncrementalStates().Empty();
+}
+
+FCustomStaticLightingSystem::FOnBuildFinished& FCustomStaticLightingSystem::OnBuildFinished()
+{
+	static FOnBuildFinished Delegate;
+	return Delegate;
+}
+
+FCustomStaticLightingSystem::FOnExportFinished& FCustomStaticLightingSystem::OnExportFinished()
+{
+	static FOnExportFinished Delegate;
+	return Delegate;
+}
+
+TMap<FString, FCustomStaticLightingSystem::FIncrementalState>& FCustomStaticLightingSystem::GetIncrementalStates()
+{
+	static TMap<FString, FIncrementalState> States;
+	return States;
+}
+
+FString FCustomStaticLightingSystem::GetIncrementalStateKey() const
+{
+	return GetWorld()->GetPathName() + TEXT("|") + (BuildDataLevel ? BuildDataLevel->GetPathName() : FString());
+}
+
+class FIncrementalLightingHashArchive : public FArchive
+{
+public:
+	FIncrementalLightingHashArchive()
+	{
+		SetIsSaving(true);
+		SetIsPersistent(true);
+	}
+
+	void Serialize(void* Data, int64 Num) override
+	{
+		Hash = CityHash64WithSeed(static_cast<const char*>(Data), Num, Hash);
+	}
+
+	FArchive& operator<<(FName& Name) override
+	{
+		FString String = Name.ToString();
+		return *this << String;
+	}
+
+	FArchive& operator<<(UObject*& Object) override
+	{
+		FString Path = Object ? Object->GetPathName() : FString();
+		return *this << Path;
+	}
+
+	uint64 Hash = 0;
+};
+
+struct FDirtyRegionOctreeSemantics
+{
+	enum { MaxElementsPerLeaf = 16 };
+	enum { MinInclusiveElementsPerNode = 7 };
+	enum { MaxNodeDepth = 12 };
+
+	typedef TInlineAllocator<MaxElementsPerLeaf> ElementAllocator;
+
+	static FBoxCenterAndExtent GetBoundingBox(const FBox& Region) { return FBoxCenterAndExtent(Region); }
+	static bool AreElementsEqual(const FBox& A, const FBox& B) { return A == B; }
+	static void SetElementId(const FBox& Region, FOctreeElementId2 Id) {}
+	static void ApplyOffset(FBox& Region, const FVector& Offset) { Region = Region.ShiftBy(Offset); }
+};
+
+uint64 FCustomStaticLightingSystem::HashGlobalInputs() const
+{
+	FIncrementalLightingHashArchive Ar;
+	uint8 Quality = Options.QualityLevel;
+	Ar << Quality;
+
+	// Anything world wide, from sky lights to lightmass settings, invalidates everything
+	uint32 WorldSettingsCrc = FArchiveObjectCrc32().Crc32(GetWorld()->GetWorldSettings());
+	Ar << WorldSettingsCrc;
+	for (ULightComponentBase* Light : Lights)
+	{
+		if (Light && !Light->IsA<ULightComponent>())
+		{
+			uint32 LightCrc = FArchiveObjectCrc32().Crc32(Light);
+			Ar << LightCrc;
+		}
+	}
+	return Ar.Hash;
+}
+
+uint64 FCustomStaticLightingSystem::HashPrimitiveInputs(const UPrimitiveComponent* Primitive,
+	TArrayView<const FStaticLightingMesh* const> PrimitiveMeshes, TArrayView<const FStaticLightingMapping* const> PrimitiveMappings) const
+{
+	FIncrementalLightingHashArchive Ar;
+
+	// Every property counts, from lightmass settings to spline deformation, referenced objects only by path
+	uint32 PrimitiveCrc = FArchiveObjectCrc32().Crc32(const_cast<UPrimitiveComponent*>(Primitive));
+	Ar << PrimitiveCrc;
+
+	FTransform Transform = Primitive->GetComponentTransform();
+	Ar << Transform;
+
+	TArray<UMaterialInterface*> Materials;
+	Primitive->GetUsedMaterials(Materials);
+	for (UMaterialInterface* Material : Materials)
+	{
+		FGuid MaterialGuid = Material ? Material->GetLightingGuid() : FGuid();
+		Ar << MaterialGuid;
+	}
+
+	TSet<const ULightComponent*> RelevantLights;
+	for (const FStaticLightingMesh* Mesh : PrimitiveMeshes)
+	{
+		FGuid Guid = Mesh->Guid, SourceMeshGuid = Mesh->SourceMeshGuid;
+		int32 NumTriangles = Mesh->NumTriangles, NumVertices = Mesh->NumVertices;
+		bool bCastShadow = Mesh->bCastShadow, bTwoSidedMaterial = Mesh->bTwoSidedMaterial;
+		Ar << Guid << SourceMeshGuid << NumTriangles << NumVertices << bCastShadow << bTwoSidedMaterial;
+
+		// Source mesh lighting Guids change with the geometry, which is placed by the transform above.
+		// Only meshes without one have to be hashed triangle by triangle, e.g. landscape heights live in textures
+		if (!SourceMeshGuid.IsValid())
+		{
+			for (int32 TriangleIndex = 0; TriangleIndex < NumTriangles; ++TriangleIndex)
+			{
+				FStaticLightingVertex V0, V1, V2;
+				Mesh->GetTriangle(TriangleIndex, V0, V1, V2);
+				Ar << V0.WorldPosition << V1.WorldPosition << V2.WorldPosition;
+			}
+		}
+
+		for (const ULightComponent* Light : Mesh->RelevantLights)
+		{
+			RelevantLights.Add(Light);
+		}
+	}
+
+	for (const FStaticLightingMapping* Mapping : PrimitiveMappings)
+	{
+		if (const FStaticLightingTextureMapping* TextureMapping = const_cast<FStaticLightingMapping*>(Mapping)->GetTextureMapping())
+		{
+			int32 SizeX = TextureMapping->SizeX, SizeY = TextureMapping->SizeY;
+			Ar << SizeX << SizeY;
+		}
+	}
+
+	// Lights are hashed by content so editing a light dirties everything it affects
+	TArray<uint32> LightCrcs;
+	for (const ULightComponent* Light : RelevantLights)
+	{
+		LightCrcs.Add(FArchiveObjectCrc32().Crc32(const_cast<ULightComponent*>(Light)));
+	}
+	LightCrcs.Sort();
+	Ar << LightCrcs;
+
+	HashCustomPrimitiveData(Primitive, Ar);
+	return Ar.Hash;
+}
+
+bool FCustomStaticLightingSystem::HasBuildData(const UPrimitiveComponent* Primitive) const
+{
+	const ULevel* Level = BuildDataLevel ? BuildDataLevel : Primitive->GetComponentLevel();
+	const UMapBuildDataRegistry* Registry = Level ? Level->MapBuildData : nullptr;
+	if (!Registry) return false;
+
+	TSet<FGuid> Guids;
+	Primitive->AddMapBuildDataGUIDs(Guids);
+	for (const FGuid& Guid : Guids)
+	{
+		if (!Registry->GetMeshBuildData(Guid)) return false;
+	}
+	return true;
+}
+
+void FCustomStaticLightingSystem::SkipCleanMappings()
+{
+	const FIncrementalState* PreviousState = GetIncrementalStates().Find(GetIncrementalStateKey());
+
+	PendingIncrementalState.Emplace();
+	FIncrementalState& NewState = PendingIncrementalState.GetValue();
+	NewState.GlobalHash = HashGlobalInputs();
+
+	TMap<const UPrimitiveComponent*, TArray<const FStaticLightingMesh*>> PrimitiveMeshes;
+	TMap<const UPrimitiveComponent*, TArray<const FStaticLightingMapping*>> PrimitiveMappings;
+	for (const auto& Mesh : Meshes)
+	{
+		if (Mesh->Component) PrimitiveMeshes.FindOrAdd(Mesh->Component).Add(Mesh);
+	}
+	for (const auto& Mapping : Mappings)
+	{
+		if (Mapping->Mesh && Mapping->Mesh->Component) PrimitiveMappings.FindOrAdd(Mapping->Mesh->Component).Add(Mapping);
+	}
+
+	// Bounds of everything that changed, before and after
+	TArray<FBox> DirtyRegions;
+	TSet<const UPrimitiveComponent*> DirtyPrimitives;
+	IncrementalDirtyPrimitives.Reset();
+	int32 NumChangedPrimitives = 0;
+	TMap<const UPrimitiveComponent*, FString> PrimitivePaths;
+	const bool bFullRebuild = !PreviousState || PreviousState->GlobalHash != NewState.GlobalHash;
+
+	for (const auto& Pair : PrimitiveMappings)
+	{
+		const UPrimitiveComponent* Primitive = Pair.Key;
+		const FString& Path = PrimitivePaths.Add(Primitive, Primitive->GetPathName());
+		const FPrimitiveState State{ HashPrimitiveInputs(Primitive, PrimitiveMeshes.FindRef(Primitive), Pair.Value), Primitive->Bounds.GetBox() };
+		NewState.Primitives.Add(Path, State);
+
+		const FPrimitiveState* PreviousPrimitive = PreviousState ? PreviousState->Primitives.Find(Path) : nullptr;
+		if (bFullRebuild || !PreviousPrimitive || PreviousPrimitive->Hash != State.Hash || !HasBuildData(Primitive))
+		{
+			NumChangedPrimitives++;
+			DirtyPrimitives.Add(Primitive);
+			DirtyRegions.Add(State.Bounds.ExpandBy(DependencyRadius));
+			if (PreviousPrimitive) DirtyRegions.Add(PreviousPrimitive->Bounds.ExpandBy(DependencyRadius));
+		}
+	}
+
+	if (PreviousState && !bFullRebuild)
+	{
+		for (const auto& Pair : PreviousState->Primitives)
+		{
+			if (NewState.Primitives.Contains(Pair.Key)) continue;
+
+			if (IsInShard(Pair.Key))
+			{
+				// Removed primitives leave holes in the shadows of their neighbors
+				NumChangedPrimitives++;
+				DirtyRegions.Add(Pair.Value.Bounds.ExpandBy(DependencyRadius));
+			}
+			else
+			{
+				// Shards that are not built this time keep their previous states
+				NewState.Primitives.Add(Pair.Key, Pair.Value);
+			}
+		}
+	}
+
+	if (bFullRebuild) return;
+
+	FBox DirtyBounds(ForceInit);
+	for (const FBox& Region : DirtyRegions)
+	{
+		DirtyBounds += Region;
+	}
+	TOctree2<FBox, FDirtyRegionOctreeSemantics> DirtyOctree(DirtyBounds.GetCenter(), DirtyBounds.GetExtent().GetMax());
+	for (const FBox& Region : DirtyRegions)
+	{
+		DirtyOctree.AddElement(Region);
+	}
+
+	for (const auto& Pair : PrimitiveMappings)
+	{
+		if (DirtyPrimitives.Contains(Pair.Key) || DirtyRegions.Num() == 0) continue;
+
+		const FBox& Bounds = NewState.Primitives[PrimitivePaths[Pair.Key]].Bounds;
+		bool bNearDirtyRegion = false;
+		DirtyOctree.FindElementsWithBoundsTest(FBoxCenterAndExtent(Bounds), [&bNearDirtyRegion](const FBox&) { bNearDirtyRegion = true; });
+		if (bNearDirtyRegion)
+		{
+			DirtyPrimitives.Add(Pair.Key);
+		}
+	}
+
+	const int32 NumMappings = Mappings.Num();
+	Mappings.RemoveAll([&](const auto& Mapping)
+	{
+		const UPrimitiveComponent* Primitive = Mapping->Mesh ? Mapping->Mesh->Component : nullptr;
+		return Primitive && !DirtyPrimitives.Contains(Primitive);
+	});
+
+	for (const auto& Pair : PrimitiveMappings)
+	{
+		if (!DirtyPrimitives.Contains(Pair.Key))
+		{
+			Pair.Key->AddMapBuildDataGUIDs(BuildDataResourcesToKeep);
+		}
+	}
+
+	UE_LOG(LogStaticLightingSystem, Log, TEXT("Incremental lighting build: %d of %d mappings are dirty (%d changed primitives)"),
+		Mappings.Num(), NumMappings, NumChangedPrimitives);
+	IncrementalDirtyPrimitives = MoveTemp(DirtyPrimitives);
+}
+
+bool FCustomStaticLightingSystem::NeedsRebuild(const UPrimitiveComponent* Primitive) const
+{
+	return !IncrementalDirtyPrimitives.IsSet() || IncrementalDirtyPrimitives->Contains(Primitive);
+}
+
+bool FCustomStaticLightingSystem::CreateLightmassProcessor()
+{
+	if (bIncremental)
+	{
+		SkipCleanMappings();
+	}
+	if (InProcessMaxTriangles > 0)
+	{
+		BeginInProcess();
+	}
+	// Bail out before the stock processor connects to Swarm, BeginLightmassProcess takes over from here.
+	// The stock BeginLightmassProcess only returns early on false, the "failed to connect to Swarm" dialog
+	// lives in FStaticLightingSystem::CreateLightmassProcessor, which in-process builds never call.
+	if (bInProcess) return false;
+
+	if (bStreamingApply)
+	{
+		BeginStreamingApply();
+	}
+	if (bTelemetry)
+	{
+		BeginTelemetry();
+	}
+
+	if (!CreateCustomLightmassProcessor()) return false;
+
+	if (StreamingTickerHandle.IsValid())
+	{
+		LightmassProcessor->SetImportCompletedMappingsImmediately(true);
+	}
+	return true;
+}
+
+void FCustomStaticLightingSystem::SetInProcessThreshold(int64 InMaxTriangles)
+{
+	InProcessMaxTriangles = InMaxTriangles;
+}
+
+void FCustomStaticLightingSystem::BeginInProcess()
+{
+	int64 NumTriangles = 0;
+	for (const auto& Mesh : Meshes)
+	{
+		NumTriangles += Mesh->NumTriangles;
+	}
+	if (NumTriangles > InProcessMaxTriangles) return;
+
+	InProcessSolver = CreateInProcessSolver();
+	bInProcess = !!InProcessSolver;
+	if (!bInProcess) return;
+
+	// Mappings are only ever solved by Lightmass, keep what they have
+	for (const auto& Mapping : Mappings)
+	{
+		if (Mapping->Mesh && Mapping->Mesh->Component)
+		{
+			Mapping->Mesh->Component->AddMapBuildDataGUIDs(BuildDataResourcesToKeep);
+		}
+	}
+	const int32 NumMappings = Mappings.Num();
+	Mappings.Empty();
+	// Stale mappings would pass as clean in the next incremental build
+	PendingIncrementalState.Reset();
+
+	UE_LOG(LogStaticLightingSystem, Log, TEXT("In-process lighting build: %lld triangles, %d mappings kept as is"), NumTriangles, NumMappings);
+}
+
+bool FCustomStaticLightingSystem::BeginLightmassProcess()
+{
+	if (FStaticLightingSystem::BeginLightmassProcess()) return true;
+	if (!bInProcess || GEditor->GetMapBuildCancelled()) return false;
+
+	// The solver captured everything it needs, skip the scene gathering, export & Swarm kickoff.
+	// Nothing but UpdateLightingBuild looks at the processor while async building, so it's fine to leave it null
+	InProcessResult = Async(EAsyncExecution::ThreadPool, MoveTemp(InProcessSolver));
+	CurrentBuildStage = FStaticLightingSystem::AsyncBuilding;
+	return true;
+}
+
+void FCustomStaticLightingSystem::UpdateLightingBuild()
+{
+	if (!bInProcess)
+	{
+		// The debug option is global, only this build's own updates process imported mappings right away
+		TGuardValue<bool> ImmediateProcessGuard(GLightmassDebugOptions.bImmediateProcessMappings,
+			GLightmassDebugOptions.bImmediateProcessMappings || StreamingTickerHandle.IsValid());
+		const bool bWasExporting = CurrentBuildStage == FStaticLightingSystem::AmortizedExport;
+		FStaticLightingSystem::UpdateLightingBuild();
+
+		// The time-sliced custom data export is part of the amortized export, instead of finishing synchronously at kickoff
+		if (bWasExporting && CurrentBuildStage == FStaticLightingSystem::SwarmKickoff && LightmassProcessor->GetLightmassExporter()->IsCustomDataExporting())
+		{
+			CurrentBuildStage = FStaticLightingSystem::AmortizedExport;
+		}
+
+		if (!bExportFinished && CurrentBuildStage == FStaticLightingSystem::AsyncBuilding)
+		{
+			bExportFinished = true;
+			OnExportFinished().Broadcast(*this);
+		}
+		return;
+	}
+
+	if (CurrentBuildStage == FStaticLightingSystem::AsyncBuilding && InProcessResult.IsReady())
+	{
+		const bool bSuccessful = InProcessResult.Get();
+		InProcessResult = TFuture<bool>();
+		UE_LOG(LogStaticLightingSystem, Log, TEXT("In-process lighting build finished in %.2fs"), FPlatformTime::Seconds() - CreationTime);
+
+		// Same as FinishLightmassProcess minus the import. Every mapping keeps its build data, so there's nothing to invalidate either
+		EncodeTextures(bSuccessful);
+		ApplyNewLightingData(bSuccessful);
+
+		if (bSuccessful)
+		{
+			CurrentBuildStage = FStaticLightingSystem::Finished;
+		}
+		else
+		{
+			FStaticLightingManager::Get()->FailLightingBuild(LOCTEXT("InProcessLightBuildFailed", "In-process lighting build failed."));
+		}
+	}
+}
+
+void FCustomStaticLightingSystem::SetStreamingApply(bool bInStreamingApply)
+{
+	bStreamingApply = bInStreamingApply;
+}
+
+void FCustomStaticLightingSystem::BeginStreamingApply()
+{
+	// The processor imports & processes mappings in its update loop as soon as they're reported complete,
+	// releasing the imported buffers right away instead of holding all of them until the end
+	StreamingTickerHandle = UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([this](float)
+	{
+		StreamCustomResults();
+		return true;
+	}));
+}
+
+void FCustomStaticLightingSystem::EndStreamingApply()
+{
+	if (StreamingTickerHandle.IsValid())
+	{
+		UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().RemoveTicker(StreamingTickerHandle);
+		StreamingTickerHandle.Reset();
+	}
+}
+
+void FCustomStaticLightingSystem::SetTelemetry(bool bInTelemetry)
+{
+	bTelemetry = bInTelemetry;
+}
+
+void FCustomStaticLightingSystem::BeginTelemetry()
+{
+	TelemetryCounters.Reset();
+	LastTelemetryTime = 0.0;
+	LastTelemetrySequence = INDEX_NONE;
+
+	const FString CsvPath = FPaths::ProjectLogDir() / FString::Printf(TEXT("CustomLightingTelemetry-%s.csv"), *FDateTime::Now().ToString());
+	TelemetryCsv.Reset(IFileManager::Get().CreateFileWriter(*CsvPath));
+	if (TelemetryCsv)
+	{
+		ANSICHAR Header[] = "Time,Counter,Value,Total,Rate\n";
+		TelemetryCsv->Serialize(Header, sizeof(Header) - 1);
+	}
+
+	// Snapshots are published at most once per second, no need to poll the agent every frame
+	TelemetryTickerHandle = UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().AddTicker(
+		FTickerDelegate::CreateRaw(this, &FCustomStaticLightingSystem::TickTelemetry), 0.5f);
+}
+
+void FCustomStaticLightingSystem::EndTelemetry()
+{
+	if (!TelemetryTickerHandle.IsValid()) return;
+
+	// Pick up the last snapshot, published when the job ended
+	TickTelemetry(0.f);
+	UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().RemoveTicker(TelemetryTickerHandle);
+	TelemetryTickerHandle.Reset();
+	TelemetryCsv.Reset();
+
+	for (const auto& Pair : TelemetryCounters)
+	{
+		UE_LOG(LogStaticLightingSystem, Log, TEXT("Lightmass telemetry: %s = %lld"), *Pair.Key, Pair.Value.Value);
+	}
+	if (const TSharedPtr<SNotificationItem> Notification = TelemetryNotification.Pin())
+	{
+		Notification->SetCompletionState(SNotificationItem::CS_None);
+		Notification->ExpireAndFadeout();
+	}
+	TelemetryNotification.Reset();
+}
+
+bool FCustomStaticLightingSystem::TickTelemetry(float DeltaTime)
+{
+	// Channel name & layout match FLightmassTelemetryPublisher on the Lightmass side
+	NSwarm::FSwarmInterface& Swarm = NSwarm::FSwarmInterface::Get();
+	const int32 Channel = Swarm.OpenChannel(TEXT("CustomTelemetry"), NSwarm::SWARM_JOB_CHANNEL_READ);
+	if (Channel < 0) return true;
+
+	TArray<uint8> Snapshot;
+	uint8 Buffer[4096];
+	int32 NumRead;
+	while ((NumRead = Swarm.ReadChannel(Channel, Buffer, sizeof(Buffer))) > 0)
+	{
+		Snapshot.Append(Buffer, NumRead);
+	}
+	Swarm.CloseChannel(Channel);
+
+	// Snapshots still being written are picked up on the next tick
+	if (ReadTelemetrySnapshot(Snapshot))
+	{
+		UpdateTelemetryNotification();
+	}
+	return true;
+}
+
+bool FCustomStaticLightingSystem::ReadTelemetrySnapshot(const TArray<uint8>& Snapshot)
+{
+	FMemoryReader Ar(Snapshot);
+	uint32 Version = 0;
+	int32 Sequence = INDEX_NONE;
+	double Time = 0.0;
+	int32 NumCounters = 0;
+	Ar << Version << Sequence << Time << NumCounters;
+	if (Version != 2 || Ar.IsError() || Sequence <= LastTelemetrySequence) return false;
+
+	struct FSnapshotCounter
+	{
+		FString Name;
+		int64 Value, Total;
+	};
+	TArray<FSnapshotCounter> Counters;
+	for (int32 Index = 0; Index < NumCounters && !Ar.IsError(); ++Index)
+	{
+		FSnapshotCounter& Counter = Counters.AddDefaulted_GetRef();
+		Ar << Counter.Name << Counter.Value << Counter.Total;
+	}
+
+	// Only complete snapshots end with their sequence number
+	int32 EndSequence = INDEX_NONE;
+	Ar << EndSequence;
+	if (Ar.IsError() || EndSequence != Sequence || Ar.Tell() != Ar.TotalSize()) return false;
+	LastTelemetrySequence = Sequence;
+
+	const double Elapsed = Time - LastTelemetryTime;
+	FString Lines;
+	for (const FSnapshotCounter& SnapshotCounter : Counters)
+	{
+		FTelemetryCounter& Counter = TelemetryCounters.FindOrAdd(SnapshotCounter.Name);
+		if (Elapsed > 0.0)
+		{
+			// Smoothed a bit, instantaneous rates of bursty task completions are too jumpy for an ETA
+			const double Rate = (SnapshotCounter.Value - Counter.Value) / Elapsed;
+			Counter.Rate = Counter.Rate > 0.0 ? FMath::Lerp(Counter.Rate, Rate, 0.3) : Rate;
+		}
+		Counter.Value = SnapshotCounter.Value;
+		Counter.Total = SnapshotCounter.Total;
+		Lines += FString::Printf(TEXT("%.2f,%s,%lld,%lld,%.2f\n"), Time, *SnapshotCounter.Name, Counter.Value, Counter.Total, Counter.Rate);
+	}
+	LastTelemetryTime = Time;
+
+	if (TelemetryCsv)
+	{
+		const FTCHARToUTF8 Utf8(*Lines);
+		TelemetryCsv->Serialize(const_cast<ANSICHAR*>(Utf8.Get()), Utf8.Length());
+		TelemetryCsv->Flush();
+	}
+	return true;
+}
+
+void FCustomStaticLightingSystem::UpdateTelemetryNotification()
+{
+	FString Text;
+	for (const auto& Pair : TelemetryCounters)
+	{
+		const FTelemetryCounter& Counter = Pair.Value;
+		Text += FString::Printf(TEXT("%s%s: %s"), Text.IsEmpty() ? TEXT("") : TEXT("\n"), *Pair.Key, *FText::AsNumber(Counter.Value).ToString());
+		if (Counter.Total > 0)
+		{
+			Text += FString::Printf(TEXT(" / %s"), *FText::AsNumber(Counter.Total).ToString());
+		}
+		Text += FString::Printf(TEXT(" (%s/s"), *FText::AsNumber(static_cast<int64>(Counter.Rate)).ToString());
+		if (Counter.Total > Counter.Value && Counter.Rate > 0.0)
+		{
+			Text += FString::Printf(TEXT(", ETA %s"), *FTimespan::FromSeconds((Counter.Total - Counter.Value) / Counter.Rate).ToString(TEXT("%h:%m:%s")));
+		}
+		Text += TEXT(")");
+	}
+
+	// A companion to the stock build notification, whose text is rewritten by the manager every frame
+	TSharedPtr<SNotificationItem> Notification = TelemetryNotification.Pin();
+	if (!Notification)
+	{
+		FNotificationInfo Info(FText::GetEmpty());
+		Info.bFireAndForget = false;
+		Notification = FSlateNotificationManager::Get().AddNotification(Info);
+		TelemetryNotification = Notification;
+	}
+	if (Notification)
+	{
+		Notification->SetText(FText::FromString(Text));
+	}
+}
+
+void FCustomStaticLightingSystem::ReadPluginMemoryReports()
+{
+	// Channel name & layout match FLightmassPluginMemoryReporter on the Lightmass side
+	NSwarm::FSwarmInterface& Swarm = NSwarm::FSwarmInterface::Get();
+	const int32 Channel = Swarm.OpenChannel(TEXT("CustomPluginMemory"), NSwarm::SWARM_JOB_CHANNEL_READ);
+	if (Channel < 0) return;
+
+	TArray<uint8> Report;
+	uint8 Buffer[4096];
+	int32 NumRead;
+	while ((NumRead = Swarm.ReadChannel(Channel, Buffer, sizeof(Buffer))) > 0)
+	{
+		Report.Append(Buffer, NumRead);
+	}
+	Swarm.CloseChannel(Channel);
+
+	FMemoryReader Ar(Report);
+	uint32 Version = 0;
+	int32 NumReports = 0;
+	Ar << Version << NumReports;
+	if (Version != 1 || Ar.IsError()) return;
+
+	for (int32 Index = 0; Index < NumReports; ++Index)
+	{
+		FString Module;
+		FPluginMemoryReport MemoryReport;
+		Ar << Module << MemoryReport.Budget << MemoryReport.TrackedPeak << MemoryReport.SampledPeak << MemoryReport.NumLowMemoryFallbacks;
+		if (Ar.IsError()) break;
+
+		UE_LOG(LogStaticLightingSystem, Log, TEXT("Lightmass plugin %s memory: tracked peak %.1f MB, sampled peak %.1f MB, %d low-memory fallbacks"),
+			*Module, MemoryReport.TrackedPeak / 1048576.0, MemoryReport.SampledPeak / 1048576.0, MemoryReport.NumLowMemoryFallbacks);
+		if (MemoryReport.Budget > 0 && FMath::Max(MemoryReport.TrackedPeak, MemoryReport.SampledPeak) > MemoryReport.Budget)
+		{
+			UE_LOG(LogStaticLightingSystem, Warning, TEXT("Lightmass plugin %s exceeded its memory budget of %.1f MB"), *Module, MemoryReport.Budget / 1048576.0);
+		}
+		PluginMemoryReports.Add(Module, MemoryReport);
+	}
+}
+
 FCustomLightmassProcessor::FCustomLightmassProcessor(const FStaticLightingSystem& InSystem, bool bInDumpBinaryResults, bool bInOnlyBuildVisibility)
 	: FLightmassProcessor(InSystem, bInDumpBinaryResults, bInOnlyBuildVisibility)
 {}
@@ -185,8 +1090,87 @@ FCustomLightmassExporter::FCustomLightmassExporter(const FStaticLightingSystem&
 #endif
 {}
 
-FCustomLightmassExporter::~FCustomLightmassExporter() {}
+void FCustomLightmassExporter::BeginCustomDataExport(double InTimeBudget)
+{
+	CustomDataTimeBudget = InTimeBudget;
+	bTimeSlicedCustomDataExport = true;
+	if (!bCustomDataExported && !CustomDataTickerHandle.IsValid())
+	{
+		CustomDataTickerHandle = UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().AddTicker(
+			FTickerDelegate::CreateRaw(this, &FCustomLightmassExporter::TickCustomDataExport));
+	}
+}
+
+float FCustomLightmassExporter::GetAmortizedExportPercentDone() const
+{
+	// Only the time-sliced export is part of the amortized one
+	if (!bTimeSlicedCustomDataExport) return FLightmassExporter::GetAmortizedExportPercentDone();
+
+	const float CustomDataPercentDone = bCustomDataExported ? 1.f : GetCustomDataExportPercentDone();
+	return (FLightmassExporter::GetAmortizedExportPercentDone() + CustomDataPercentDone) * 0.5f;
+}
+
+void FCustomLightmassExporter::WriteCustomData(int32 Channel, bool bForceContentExport)
+{
+	FinishCustomDataExport();
+	FLightmassExporter::WriteCustomData(Channel, bForceContentExport);
+}
+
+void FCustomLightmassExporter::SetPluginMemoryBudget(const FString& Module, int64 Budget)
+{
+	if (Budget > 0)
+	{
+		GetPluginMemoryBudgets().Add(Module, Budget);
+	}
+	else
+	{
+		GetPluginMemoryBudgets().Remove(Module);
+	}
+}
+
+bool FCustomLightmassExporter::TickCustomDataExport(float DeltaTime)
+{
+	bCustomDataExported = ExportCustomDataIncremental(FPlatformTime::Seconds() + CustomDataTimeBudget);
+	if (bCustomDataExported)
+	{
+		CustomDataTickerHandle.Reset();
+	}
+	return !bCustomDataExported;
+}
+
+void FCustomLightmassExporter::FinishCustomDataExport()
+{
+	if (CustomDataTickerHandle.IsValid())
+	{
+		UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().RemoveTicker(CustomDataTickerHandle);
+		CustomDataTickerHandle.Reset();
+	}
+
+	// Also covers subclasses that never started the time-sliced export
+	while (!bCustomDataExported)
+	{
+		bCustomDataExported = ExportCustomDataIncremental(DBL_MAX);
+	}
+}
+
+FCustomLightmassExporter::~FCustomLightmassExporter()
+{
+	if (CustomDataTickerHandle.IsValid())
+	{
+		UE_CONDITIONAL_ON_5_0(FTicker, FTSTicker)::GetCoreTicker().RemoveTicker(CustomDataTickerHandle);
+	}
+}
 FCustomLightmassProcessor::~FCustomLightmassProcessor() {}
-FCustomStaticLightingSystem::~FCustomStaticLightingSystem() {}
+FCustomStaticLightingSystem::~FCustomStaticLightingSystem()
+{
+	// Canceled builds are destroyed while the solver may still be running
+	if (InProcessResult.IsValid())
+	{
+		InProcessResult.Wait();
+	}
+	// Canceled or failed builds never reach ApplyNewLightingData
+	EndStreamingApply();
+	EndTelemetry();
+}
 
 #undef LOCTEXT_NAMESPACE
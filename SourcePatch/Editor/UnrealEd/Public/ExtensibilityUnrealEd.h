@@ -3,6 +3,9 @@
 
 #pragma once
 
+#include "ExtensibilityCoreMinimal.h"
+#include "Async/Future.h"
+#include "Containers/Ticker.h"
 #include "Lightmass/Lightmass.h"
 #include "StaticLightingSystem/StaticLightingPrivate.h"
 
@@ -11,6 +14,167 @@ class UNREALED_API FCustomStaticLightingSystem : public FStaticLightingSystem
 public:
 	FCustomStaticLightingSystem(const FLightingBuildOptions& InOptions, UWorld* InWorld, ULevel* InLightingScenario);
 	~FCustomStaticLightingSystem() override;
+
+	/** Only solve a deterministic subset of the mappings, while still exporting every mesh as scene data.
+	 * Build data of the mappings from other shards is kept intact. Shards are meant to run concurrently in their own processes
+	 * and get merged afterwards, see -Shards of UCustomLightingBuildCommandlet. Custom tasks should be filtered with IsInShard too. */
+	void SetShard(int32 InShardIndex, int32 InNumShards);
+	// Mesh & build data Guids go with their primitive, only meaningful after the static lighting info is gathered
+	bool IsInShard(const FGuid& Guid) const;
+	bool IsInShard(const UPrimitiveComponent* Primitive) const;
+	bool IsInShard(const FString& PrimitivePath) const;
+
+	// The partition key behind every IsInShard, path names are stable across sessions & processes
+	static int32 GetPrimitiveShard(const FString& PrimitivePath, int32 InNumShards);
+
+	int32 GetShardIndex() const { return ShardIndex; }
+	int32 GetNumShards() const { return NumShards; }
+
+	/** Only solve the primitives whose inputs changed since the last successful incremental build of the same world & scenario,
+	 * plus every primitive within DependencyRadius of them. Everything else keeps its current build data. */
+	void SetIncremental(bool bInIncremental, float InDependencyRadius = 2000.f);
+
+	/** Forget all the recorded incremental states, the next incremental build of each world is a full one. */
+	static void ResetIncrementalStates();
+
+	DECLARE_MULTICAST_DELEGATE_TwoParams(FOnBuildFinished, const FCustomStaticLightingSystem&, bool /* bSuccessful */);
+
+	/** Broadcast right after the new lighting data is applied. Builds that fail or get canceled before that never broadcast. */
+	static FOnBuildFinished& OnBuildFinished();
+
+	DECLARE_MULTICAST_DELEGATE_OneParam(FOnExportFinished, const FCustomStaticLightingSystem&);
+
+	/** Broadcast once the scene is handed over to Swarm. Meshes & materials are in the Swarm cache from then on,
+	 * so other builds of the same scene skip exporting them. */
+	static FOnExportFinished& OnExportFinished();
+
+	/** Whether the primitive is solved in this build, custom tasks of clean primitives can be skipped.
+	 * Only meaningful after CreateLightmassProcessor. */
+	bool NeedsRebuild(const UPrimitiveComponent* Primitive) const;
+
+	/** Import & apply mappings while Lightmass is still running, instead of holding every result in memory until the end.
+	 * Subclasses should import & apply their own completed tasks in StreamCustomResults. */
+	void SetStreamingApply(bool bInStreamingApply);
+
+	/** Poll the counters Lightmass plugins publish through FLightmassTelemetry during the build,
+	 * show their rates & ETA in a notification and log every snapshot to Saved/Logs/CustomLightingTelemetry-*.csv */
+	void SetTelemetry(bool bInTelemetry);
+
+	/** Solve builds with at most MaxTriangles in the scene right in the editor, with the solver from CreateInProcessSolver,
+	 * skipping the Lightmass processor, Swarm connection & the UnrealLightmass process altogether. Zero to always go through Lightmass.
+	 * Only custom data is solved this way, mappings keep their current build data. */
+	void SetInProcessThreshold(int64 InMaxTriangles);
+
+	// Whether this build is solved in the editor, only meaningful after CreateLightmassProcessor
+	bool IsInProcess() const { return bInProcess; }
+
+	struct FPluginMemoryReport
+	{
+		int64 Budget = 0;
+		// Bytes passed to FLightmassPluginMemory::Track
+		int64 TrackedPeak = 0;
+		// Process memory sampled inside FLightmassPluginMemoryScope
+		int64 SampledPeak = 0;
+		int32 NumLowMemoryFallbacks = 0;
+	};
+
+	// Memory peaks of each Lightmass plugin module, sent along with the results. Filled in by the time OnBuildFinished is broadcast
+	const TMap<FString, FPluginMemoryReport>& GetPluginMemoryReports() const { return PluginMemoryReports; }
+
+protected:
+	// Always call these from subclasses
+	bool BeginLightmassProcess() override;
+	bool CustomizePrimitiveInfo(UPrimitiveComponent* Primitive, FStaticLightingPrimitiveInfo& PrimitiveInfo) override;
+	void ApplyNewLightingData(bool bSuccessful) override;
+	void UpdateLightingBuild() override;
+
+	/** Sets up incremental, in-process, streaming & telemetry builds, then leaves the processor to CreateCustomLightmassProcessor.
+	 * In-process builds create no processor at all, BeginLightmassProcess starts the solver instead. */
+	bool CreateLightmassProcessor() override final;
+
+	/** Create the processor here instead of overriding CreateLightmassProcessor, e.g. a subclass of FCustomLightmassProcessor.
+	 * Meshes & mappings are final by now. Creates the stock processor by default. */
+	virtual bool CreateCustomLightmassProcessor() { return FStaticLightingSystem::CreateLightmassProcessor(); }
+
+	/** Serialize everything plugin specific that affects the lighting of the primitive, for change tracking. */
+	virtual void HashCustomPrimitiveData(const UPrimitiveComponent* Primitive, FArchive& Ar) const {}
+
+	/** Called every editor tick during a streaming build, and once more right before applying. */
+	virtual void StreamCustomResults() {}
+
+	/** In-editor solver for small builds, return null to go through Lightmass anyway.
+	 * Called on the game thread once the static lighting info is gathered, capture everything needed from UObjects here.
+	 * The returned function runs on a worker thread, should poll GEditor->GetMapBuildCancelled and return whether it succeeded.
+	 * Results are applied in ApplyNewLightingData as usual, check IsInProcess there instead of importing from Lightmass. */
+	virtual TFunction<bool()> CreateInProcessSolver() { return nullptr; }
+
+private:
+	struct FPrimitiveState
+	{
+		uint64 Hash;
+		FBox Bounds;
+	};
+
+	struct FIncrementalState
+	{
+		uint64 GlobalHash = 0;
+		TMap<FString, FPrimitiveState> Primitives;
+	};
+
+	static TMap<FString, FIncrementalState>& GetIncrementalStates();
+	FString GetIncrementalStateKey() const;
+	uint64 HashGlobalInputs() const;
+	uint64 HashPrimitiveInputs(const UPrimitiveComponent* Primitive, TArrayView<const FStaticLightingMesh* const> PrimitiveMeshes, TArrayView<const FStaticLightingMapping* const> PrimitiveMappings) const;
+	bool HasBuildData(const UPrimitiveComponent* Primitive) const;
+	void SkipCleanMappings();
+	void BeginStreamingApply();
+	void EndStreamingApply();
+	void BeginTelemetry();
+	void EndTelemetry();
+	bool TickTelemetry(float DeltaTime);
+	bool ReadTelemetrySnapshot(const TArray<uint8>& Snapshot);
+	void UpdateTelemetryNotification();
+	void BeginInProcess();
+	void ReadPluginMemoryReports();
+
+	int32 ShardIndex = 0;
+	int32 NumShards = 1;
+	int32 NumShardMappings = 0;
+	int32 NumSkippedMappings = 0;
+	TMap<FGuid, int32> GuidShards;
+	bool bExportFinished = false;
+	double CreationTime;
+
+	ULevel* BuildDataLevel;
+	bool bIncremental = false;
+	float DependencyRadius = 0.f;
+	TOptional<FIncrementalState> PendingIncrementalState;
+	TOptional<TSet<const UPrimitiveComponent*>> IncrementalDirtyPrimitives;
+
+	bool bStreamingApply = false;
+	UE_CONDITIONAL_ON_5_0(FDelegateHandle, FTSTicker::FDelegateHandle) StreamingTickerHandle;
+
+	struct FTelemetryCounter
+	{
+		int64 Value = 0;
+		int64 Total = 0;
+		double Rate = 0.0;
+	};
+
+	bool bTelemetry = false;
+	TMap<FString, FTelemetryCounter> TelemetryCounters;
+	double LastTelemetryTime = 0.0;
+	int32 LastTelemetrySequence = INDEX_NONE;
+	TUniquePtr<FArchive> TelemetryCsv;
+	TWeakPtr<class SNotificationItem> TelemetryNotification;
+	UE_CONDITIONAL_ON_5_0(FDelegateHandle, FTSTicker::FDelegateHandle) TelemetryTickerHandle;
+
+	int64 InProcessMaxTriangles = 0;
+	bool bInProcess = false;
+	TFunction<bool()> InProcessSolver;
+	TFuture<bool> InProcessResult;
+
+	TMap<FString, FPluginMemoryReport> PluginMemoryReports;
 };
 
 class UNREALED_API FCustomLightmassProcessor : public FLightmassProcessor
@@ -25,6 +189,90 @@ class UNREALED_API FCustomLightmassExporter : public FLightmassExporter
 public:
 	explicit FCustomLightmassExporter(const FStaticLightingSystem& InSystem);
 	~FCustomLightmassExporter() override;
+
+	/** Start preparing the custom data in time slices on every editor tick, as part of the amortized export.
+	 * Custom systems wait in the amortized export stage until it's done, the progress shows in the build notification. */
+	void BeginCustomDataExport(double InTimeBudget = 0.005);
+	bool IsCustomDataExporting() const override { return CustomDataTickerHandle.IsValid(); }
+
+	// Stock amortized export and custom data export progress combined, once BeginCustomDataExport is called
+	float GetAmortizedExportPercentDone() const override;
+
+	// Subclasses should call this one instead of FLightmassExporter::WriteCustomData
+	void WriteCustomData(int32 Channel, bool bForceContentExport) override;
+
+	/** Memory budget in bytes for a Lightmass plugin module, zero for unlimited.
+	 * Plugins query it through FLightmassPluginMemory::ShouldUseLowMemoryPath to fall back before running out of memory. */
+	static void SetPluginMemoryBudget(const FString& Module, int64 Budget);
+
+protected:
+	/** Prepare the custom data in small steps, yielding once EndTime has passed. Return true when done. */
+	virtual bool ExportCustomDataIncremental(double EndTime) { return true; }
+	virtual float GetCustomDataExportPercentDone() const { return 1.f; }
+
+private:
+	bool TickCustomDataExport(float DeltaTime);
+	// Finishes the time-sliced export right away, when the channel gets written before it's done
+	void FinishCustomDataExport();
+
+	double CustomDataTimeBudget = 0.0;
+	bool bTimeSlicedCustomDataExport = false;
+	bool bCustomDataExported = false;
+	UE_CONDITIONAL_ON_5_0(FDelegateHandle, FTSTicker::FDelegateHandle) CustomDataTickerHandle;
+};
+
+/** Runs custom lighting builds back to back, launching the next one as soon as the manager becomes idle.
+ * Only available when the lightmass patches are applied. */
+class UNREALED_API FCustomStaticLightingQueue final
+{
+public:
+	enum class EBuildState : uint8
+	{
+		Queued,
+		Started,
+		// Successfully applied
+		Finished,
+		Failed,
+		Canceled,
+	};
+
+	DECLARE_MULTICAST_DELEGATE_TwoParams(FOnBuildStateChanged, int32 /* BuildId */, EBuildState);
+
+	static FCustomStaticLightingQueue& Get();
+
+	// Takes ownership of the system, returns an ID for tracking & cancellation
+	int32 Enqueue(FCustomStaticLightingSystem* System, const FText& DisplayName = FText());
+	bool Cancel(int32 BuildId);
+	void CancelAll();
+
+	int32 NumPending() const { return PendingBuilds.Num(); }
+	bool IsActive(int32 BuildId) const { return BuildId != INDEX_NONE && BuildId == ActiveBuildId; }
+
+	FOnBuildStateChanged& OnBuildStateChanged() { return BuildStateChanged; }
+
+private:
+	struct FPendingBuild
+	{
+		int32 BuildId;
+		FText DisplayName;
+		TUniquePtr<FCustomStaticLightingSystem> System;
+	};
+
+	FCustomStaticLightingQueue();
+
+	bool Tick(float DeltaTime);
+	void FinishActiveBuild();
+	void OnBuildFinished(const FCustomStaticLightingSystem& System, bool bSuccessful);
+	void Notify(const FText& Text) const;
+
+	TArray<FPendingBuild> PendingBuilds;
+	int32 ActiveBuildId = INDEX_NONE;
+	const FCustomStaticLightingSystem* ActiveSystem = nullptr;
+	bool bActiveBuildSucceeded = false;
+	int32 NextBuildId = 0;
+
+	FOnBuildStateChanged BuildStateChanged;
+	UE_CONDITIONAL_ON_5_0(FDelegateHandle, FTSTicker::FDelegateHandle) TickerHandle;
 };
 
 class FEditorExtensibilityUtils final
@@ -41,20 +289,53 @@ public:
 
 extern UNREALED_API void CreateBrushForVolumeActorHelper(AVolume* NewActor, UBrushBuilder* BrushBuilder);
 extern UNREALED_API void UpdateLevelBounds(ULevel* Level);
+// Bounds are computed in parallel, returns the packages whose tile info actually changed (and are now dirty)
+extern UNREALED_API TArray<UPackage*> UpdateLevelBounds(TArrayView<ULevel* const> Levels, float Tolerance = UE_KINDA_SMALL_NUMBER);
 extern UNREALED_API void SavePackageWithConsistentGuid(UPackage* Package);
+// Source control states are updated & checked out in bulk. Pass a custom provider to override the one from the module
+extern UNREALED_API bool SavePackagesWithConsistentGuid(TArrayView<UPackage* const> Packages, class ISourceControlProvider* Provider = nullptr);
 
-template<typename ActorType>
-static ActorType* FindOrCreateActor(ULevel* Level)
+/** Per-level lookup from actor class to the first actor of that class (or any subclass).
+ * Entries are built lazily in one pass over the level and kept in sync with editor spawn & destroy events. */
+class UNREALED_API FLevelActorIndex final
 {
-	ActorType* Result;
-	if (auto* ActorIt = Level->Actors.FindByPredicate([](const AActor* Actor)
-		{
-			return Cast<ActorType>(Actor);
-		}))
+public:
+	static FLevelActorIndex& Get();
+
+	AActor* Find(ULevel* Level, const UClass* Class);
+
+	template<typename ActorType>
+	ActorType* Find(ULevel* Level)
 	{
-		Result = Cast<ActorType>(*ActorIt);
+		return static_cast<ActorType*>(Find(Level, ActorType::StaticClass()));
 	}
-	else
+
+	// Pass null to drop every level
+	void Invalidate(const ULevel* Level = nullptr);
+
+private:
+	struct FLevelEntry
+	{
+		TMap<const UClass*, TWeakObjectPtr<AActor>> Actors;
+		int32 NumLevelActors = 0;
+	};
+
+	FLevelActorIndex();
+
+	FLevelEntry& FindOrBuildEntry(ULevel* Level);
+	static void AddActor(FLevelEntry& Entry, AActor* Actor);
+
+	void OnLevelActorAdded(AActor* Actor);
+	void OnLevelActorDeleted(AActor* Actor);
+
+	TMap<TWeakObjectPtr<ULevel>, FLevelEntry> Levels;
+};
+
+template<typename ActorType>
+static ActorType* FindOrCreateActor(ULevel* Level)
+{
+	ActorType* Result = FLevelActorIndex::Get().Find<ActorType>(Level);
+	if (!Result)
 	{
 		FActorSpawnParameters SpawnParams;
 		SpawnParams.OverrideLevel = Level;
@@ -62,3 +343,10 @@ static ActorType* FindOrCreateActor(ULevel* Level)
 	}
 	return Result;
 }
+
+// The level is scanned at most once no matter how many types are requested
+template<typename... ActorTypes>
+static TTuple<ActorTypes*...> FindOrCreateActors(ULevel* Level)
+{
+	return TTuple<ActorTypes*...>(FindOrCreateActor<ActorTypes>(Level)...);
+}
@@ -11,7 +11,9 @@
 
 #include "Exporter.h"
 #include "LightingSystem.h"
+#include "LightmassRayQuery.h"
 #include "LightmassSwarm.h"
+#include "Misc/PrivateAccessor.h"
 
 // ReSharper disable CppUnusedIncludeDirective
 #include "Collision.cpp"
@@ -25,6 +27,10 @@
 #include "StaticMesh.cpp"
 // ReSharper restore CppUnusedIncludeDirective
 
+#if USE_EMBREE
+DEFINE_PRIVATE_ACCESSOR_VARIABLE(GetAggregateEmbreeScene, Lightmass::FEmbreeAggregateMesh, RTCScene, EmbreeScene);
+#endif
+
 DEFINE_LOG_CATEGORY(LogLightmass);
 namespace Lightmass
 {
@@ -45,6 +51,13 @@ namespace Lightmass
 		return Swarm;
 	}
 
+#if USE_EMBREE
+	RTCScene FLightmassRayQuery::GetEmbreeScene(const FEmbreeAggregateMesh& Mesh)
+	{
+		return PrivateAccess(Mesh, GetAggregateEmbreeScene);
+	}
+#endif
+
 	void FStaticLightingMesh::SetDebugMaterial(bool bInUseDebugMaterial, FLinearColor InDiffuse)
 	{
 		bUseDebugMaterial = bInUseDebugMaterial;
@@ -84,6 +97,9 @@ namespace Lightmass
 	template<typename DataType>
 	void TCompleteTaskList<DataType>::ApplyAndClear(FStaticLightingSystem& LightingSystem)
 	{
+		// Polled from the main loop whether or not anything completed, so counters of long running tasks keep flowing
+		FLightmassTelemetryPublisher::Get().Publish(*LightingSystem.GetExporter().GetSwarm());
+
 		while(this->FirstElement)
 		{
 			// Atomically read the complete list and clear the shared head pointer.
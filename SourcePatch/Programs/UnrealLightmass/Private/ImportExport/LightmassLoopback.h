@@ -0,0 +1,367 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "Exporter.h"
+#include "Features/IModularFeature.h"
+#include "Features/IModularFeatures.h"
+#include "Importer.h"
+#include "LightmassScene.h"
+#include "LightmassSwarm.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/LightmassCustomDataHeader.h"
+#include "SwarmInterface.h"
+
+namespace Lightmass
+{
+	/** In-memory stand-in for the Swarm agent: channels are plain byte arrays, tasks added to the job
+	 * are handed out on request, and everything else is recorded for inspection. Not thread safe. */
+	class FSwarmLoopback final : public NSwarm::FSwarmInterface
+	{
+	public:
+		FSwarmLoopback() = default;
+		~FSwarmLoopback() override = default;
+
+		int32 OpenConnection(NSwarm::FConnectionCallback InCallbackFunc, void* InCallbackData, NSwarm::TLogFlags, const TCHAR*) override
+		{
+			CallbackFunc = InCallbackFunc;
+			CallbackData = InCallbackData;
+			return 0;
+		}
+
+		int32 CloseConnection() override
+		{
+			CallbackFunc = nullptr;
+			return NSwarm::SWARM_SUCCESS;
+		}
+
+		int32 SendMessage(const NSwarm::FMessage& Message) override
+		{
+			switch (Message.Type)
+			{
+			case NSwarm::MESSAGE_TASK_REQUEST:
+				if (CallbackFunc)
+				{
+					if (PendingTasks.Num())
+					{
+						const FTask Task = PendingTasks[0];
+						PendingTasks.RemoveAt(0);
+						NSwarm::FTaskSpecification Specification(Task.Guid, *Task.Parameters, NSwarm::JOB_TASK_FLAG_USE_DEFAULTS);
+						CallbackFunc(&Specification, CallbackData);
+					}
+					else
+					{
+						NSwarm::FTaskRequestResponse Release(NSwarm::RESPONSE_TYPE_RELEASE);
+						CallbackFunc(&Release, CallbackData);
+					}
+				}
+				break;
+			case NSwarm::MESSAGE_TASK_STATE:
+				NumTaskStateMessages++;
+				break;
+			case NSwarm::MESSAGE_INFO:
+				Messages.Add(static_cast<const NSwarm::FInfoMessage&>(Message).TextMessage);
+				break;
+			default:
+				break;
+			}
+			return NSwarm::SWARM_SUCCESS;
+		}
+
+		int32 AddChannel(const TCHAR* FullPath, const TCHAR* ChannelName) override
+		{
+			TSharedRef<TArray<uint8>> Data = MakeShared<TArray<uint8>>();
+			if (!FFileHelper::LoadFileToArray(*Data, FullPath)) return NSwarm::SWARM_INVALID;
+			Channels.Add(ChannelName, Data);
+			return NSwarm::SWARM_SUCCESS;
+		}
+
+		int32 TestChannel(const TCHAR* ChannelName) override
+		{
+			return Channels.Contains(ChannelName) ? NSwarm::SWARM_SUCCESS : NSwarm::SWARM_INVALID;
+		}
+
+		int32 OpenChannel(const TCHAR* ChannelName, NSwarm::TChannelFlags ChannelFlags) override
+		{
+			const bool bWrite = (ChannelFlags & NSwarm::SWARM_CHANNEL_ACCESS_WRITE) != 0;
+			if (!bWrite && !Channels.Contains(ChannelName)) return NSwarm::SWARM_INVALID;
+
+			if (bWrite) Channels.Add(ChannelName, MakeShared<TArray<uint8>>());
+			return OpenChannels.Add({ Channels.FindChecked(ChannelName), 0, bWrite });
+		}
+
+		int32 CloseChannel(int32 Channel) override
+		{
+			if (!OpenChannels.IsValidIndex(Channel)) return NSwarm::SWARM_INVALID;
+			OpenChannels.RemoveAt(Channel);
+			return NSwarm::SWARM_SUCCESS;
+		}
+
+		int32 WriteChannel(int32 Channel, const void* Data, int32 DataSize) override
+		{
+			if (!OpenChannels.IsValidIndex(Channel) || !OpenChannels[Channel].bWrite) return NSwarm::SWARM_INVALID;
+			OpenChannels[Channel].Data->Append(static_cast<const uint8*>(Data), DataSize);
+			return DataSize;
+		}
+
+		int32 ReadChannel(int32 Channel, void* Data, int32 DataSize) override
+		{
+			if (!OpenChannels.IsValidIndex(Channel) || OpenChannels[Channel].bWrite) return NSwarm::SWARM_INVALID;
+			FOpenChannel& OpenChannel = OpenChannels[Channel];
+			const int32 NumRead = static_cast<int32>(FMath::Min<int64>(DataSize, OpenChannel.Data->Num() - OpenChannel.Offset));
+			FMemory::Memcpy(Data, OpenChannel.Data->GetData() + OpenChannel.Offset, NumRead);
+			OpenChannel.Offset += NumRead;
+			return NumRead;
+		}
+
+		int32 OpenJob(const FGuid& InJobGuid) override { JobGuid = InJobGuid; return NSwarm::SWARM_SUCCESS; }
+		int32 BeginJobSpecification(const NSwarm::FJobSpecification&, const NSwarm::FJobSpecification&) override { return NSwarm::SWARM_SUCCESS; }
+		int32 AddTask(const NSwarm::FTaskSpecification& Specification) override
+		{
+			PendingTasks.Add({ Specification.TaskGuid, Specification.Parameters });
+			return NSwarm::SWARM_SUCCESS;
+		}
+		int32 EndJobSpecification() override { return NSwarm::SWARM_SUCCESS; }
+		int32 CloseJob() override { return NSwarm::SWARM_SUCCESS; }
+		int32 Log(NSwarm::TVerbosityLevel, NSwarm::TLogColour, const TCHAR* Message) override
+		{
+			Messages.Add(Message);
+			return NSwarm::SWARM_SUCCESS;
+		}
+		void SetJobGuid(const FGuid& InJobGuid) override { JobGuid = InJobGuid; }
+		bool IsJobProcessRunning(int32* OutStatus) override { if (OutStatus) *OutStatus = 0; return true; }
+
+		void AddTask(const FGuid& TaskGuid, const FString& Parameters = FString()) { PendingTasks.Add({ TaskGuid, Parameters }); }
+
+		const TArray<uint8>* FindChannel(const FString& ChannelName) const
+		{
+			const TSharedRef<TArray<uint8>>* Data = Channels.Find(ChannelName);
+			return Data ? &Data->Get() : nullptr;
+		}
+
+		int64 GetTotalChannelSize() const
+		{
+			int64 Size = 0;
+			for (const TPair<FString, TSharedRef<TArray<uint8>>>& Channel : Channels) Size += Channel.Value->Num();
+			return Size;
+		}
+
+		const TArray<FString>& GetMessages() const { return Messages; }
+		int32 GetNumTaskStateMessages() const { return NumTaskStateMessages; }
+
+		// Channels can be dumped & reloaded to replay captured data
+		void SaveChannels(const FString& Directory) const
+		{
+			for (const TPair<FString, TSharedRef<TArray<uint8>>>& Channel : Channels)
+			{
+				FFileHelper::SaveArrayToFile(*Channel.Value, *FPaths::Combine(Directory, Channel.Key));
+			}
+		}
+
+	private:
+		struct FTask
+		{
+			FGuid Guid;
+			FString Parameters;
+		};
+
+		struct FOpenChannel
+		{
+			TSharedRef<TArray<uint8>> Data;
+			int64 Offset;
+			bool bWrite;
+		};
+
+		NSwarm::FConnectionCallback CallbackFunc = nullptr;
+		void* CallbackData = nullptr;
+		FGuid JobGuid;
+
+		// Shared with the open channels, which stay valid when more are added
+		TMap<FString, TSharedRef<TArray<uint8>>> Channels;
+		TSparseArray<FOpenChannel> OpenChannels;
+		TArray<FTask> PendingTasks;
+		TArray<FString> Messages;
+		int32 NumTaskStateMessages = 0;
+	};
+
+	/** Headless benchmark of the plugin custom data path, running export, import and result export in one process:
+	 *	- Custom data starts with the same FLightmassCustomDataHeader as FLightmassExporter::WriteCustomData, the plugin payload
+	 *	  by the same code the editor exporter uses, as long as it only relies on NSwarm::FSwarmInterface.
+	 *	- It is read back through FLightmassImporter::ImportCustomData, which calls each ILightmassPlugin::Import.
+	 *	- Optional synthetic results go through FLightmassSolverExporter::ExportResults.
+	 * Plugins register an FFeature from StartupModule, and UnrealLightmass runs every registered one instead of a job when launched with
+	 * -CustomDataBenchmark, e.g.
+	 *	UnrealLightmass -CustomDataBenchmark -BenchmarkSizes=1000+100000 -BenchmarkIterations=5 -BenchmarkReport=Bench.csv */
+	class FLightmassLoopbackBenchmark
+	{
+	public:
+		struct FSettings
+		{
+			// Same format as FLightmassExporter::DependentPluginModules
+			FString DependentPluginModules;
+			// Writes the plugin payload following the module list, for a synthetic scene of the given size
+			TFunction<void(NSwarm::FSwarmInterface& Swarm, int32 Channel, int32 SceneSize)> WriteCustomData;
+			// Optional, exports synthetic task results of the given size
+			TFunction<void(const FLightmassSolverExporter& Exporter, int32 SceneSize)> ExportResults;
+
+			TArray<int32> SceneSizes = { 1000 };
+			int32 Iterations = 3;
+			FString ReportPath;
+		};
+
+		// Registered with IModularFeatures::Get().RegisterModularFeature(FFeature::GetFeatureName(), &Feature), so the executable sees the ones from plugin binaries too
+		struct FFeature : IModularFeature
+		{
+			static FName GetFeatureName() { return TEXT("LightmassCustomDataBenchmark"); }
+			FSettings Settings;
+		};
+
+		struct FResult
+		{
+			int32 SceneSize = 0;
+			int64 CustomDataBytes = 0;
+			int64 ResultBytes = 0;
+			double ExportSeconds = 0.0;
+			double ImportSeconds = 0.0;
+			double ResultExportSeconds = 0.0;
+			int64 ImportMemoryGrowth = 0;
+		};
+
+		static bool IsRequested()
+		{
+			return FParse::Param(FCommandLine::Get(), TEXT("CustomDataBenchmark"));
+		}
+
+		// Overrides the defaults with -BenchmarkSizes, -BenchmarkIterations & -BenchmarkReport
+		static void ParseCommandLine(FSettings& Settings)
+		{
+			FString Sizes;
+			if (FParse::Value(FCommandLine::Get(), TEXT("-BenchmarkSizes="), Sizes))
+			{
+				TArray<FString> Tokens;
+				Sizes.ParseIntoArray(Tokens, TEXT("+"));
+				Settings.SceneSizes.Reset();
+				for (const FString& Token : Tokens) Settings.SceneSizes.Add(FCString::Atoi(*Token));
+			}
+			FParse::Value(FCommandLine::Get(), TEXT("-BenchmarkIterations="), Settings.Iterations);
+			FParse::Value(FCommandLine::Get(), TEXT("-BenchmarkReport="), Settings.ReportPath);
+		}
+
+		// Entry point of -CustomDataBenchmark, called by UnrealLightmass once the plugins are loaded. Returns the process exit code
+		static int32 RunRegistered()
+		{
+			const TArray<FFeature*> Features = IModularFeatures::Get().GetModularFeatureImplementations<FFeature>(FFeature::GetFeatureName());
+			if (!Features.Num())
+			{
+				UE_LOG(LogLightmass, Error, TEXT("Custom data benchmark requested, but no plugin registered one"));
+				return 1;
+			}
+
+			for (int32 Index = 0; Index < Features.Num(); ++Index)
+			{
+				FSettings Settings = Features[Index]->Settings;
+				ParseCommandLine(Settings);
+				// Several plugins would overwrite each other's report
+				if (Features.Num() > 1 && !Settings.ReportPath.IsEmpty())
+				{
+					Settings.ReportPath = FPaths::GetBaseFilename(Settings.ReportPath, false) + FString::Printf(TEXT("_%d"), Index) + FPaths::GetExtension(Settings.ReportPath, true);
+				}
+				UE_LOG(LogLightmass, Display, TEXT("Custom data benchmark of %s"), *Settings.DependentPluginModules);
+				Run(Settings);
+			}
+			return 0;
+		}
+
+		static TArray<FResult> Run(const FSettings& Settings)
+		{
+			TArray<FResult> Results;
+			for (const int32 SceneSize : Settings.SceneSizes)
+			{
+				// Keep the fastest iteration, the rest is mostly noise from cold caches
+				FResult Best;
+				for (int32 Iteration = 0; Iteration < FMath::Max(Settings.Iterations, 1); ++Iteration)
+				{
+					const FResult Result = RunOnce(Settings, SceneSize);
+					if (Iteration == 0 || Result.ExportSeconds + Result.ImportSeconds < Best.ExportSeconds + Best.ImportSeconds)
+					{
+						Best = Result;
+					}
+				}
+				Results.Add(Best);
+
+				UE_LOG(LogLightmass, Display, TEXT("Custom data benchmark, scene size %d: %.1f MB exported at %.1f MB/s, imported at %.1f MB/s (+%.1f MB), %.1f MB of results at %.1f MB/s"),
+					SceneSize, Best.CustomDataBytes / 1048576.0, GetThroughput(Best.CustomDataBytes, Best.ExportSeconds), GetThroughput(Best.CustomDataBytes, Best.ImportSeconds),
+					Best.ImportMemoryGrowth / 1048576.0, Best.ResultBytes / 1048576.0, GetThroughput(Best.ResultBytes, Best.ResultExportSeconds));
+			}
+
+			if (!Settings.ReportPath.IsEmpty())
+			{
+				FString Report = TEXT("SceneSize,CustomDataBytes,ExportSeconds,ImportSeconds,ImportMemoryGrowth,ResultBytes,ResultExportSeconds\n");
+				for (const FResult& Result : Results)
+				{
+					Report += FString::Printf(TEXT("%d,%lld,%f,%f,%lld,%lld,%f\n"), Result.SceneSize, Result.CustomDataBytes,
+						Result.ExportSeconds, Result.ImportSeconds, Result.ImportMemoryGrowth, Result.ResultBytes, Result.ResultExportSeconds);
+				}
+				FFileHelper::SaveStringToFile(Report, *Settings.ReportPath);
+			}
+			return Results;
+		}
+
+	private:
+		static double GetThroughput(int64 Bytes, double Seconds)
+		{
+			return Seconds > 0.0 ? Bytes / 1048576.0 / Seconds : 0.0;
+		}
+
+		static FResult RunOnce(const FSettings& Settings, int32 SceneSize)
+		{
+			static const TCHAR* ChannelName = TEXT("CustomDataBenchmark");
+
+			FResult Result;
+			Result.SceneSize = SceneSize;
+			FSwarmLoopback Loopback;
+
+			// Export, with the same header as FLightmassExporter::WriteCustomData
+			double StartTime = FPlatformTime::Seconds();
+			{
+				const int32 Channel = Loopback.OpenChannel(ChannelName, NSwarm::SWARM_JOB_CHANNEL_WRITE);
+				FLightmassCustomDataHeader Header;
+				Header.DependentPluginModules = Settings.DependentPluginModules;
+				Header.MemoryBudgets.SetNumZeroed(Header.GetModules().Num());
+				Header.Write([&Loopback, Channel](const void* Data, int32 Size) { Loopback.WriteChannel(Channel, Data, Size); });
+				Settings.WriteCustomData(Loopback, Channel, SceneSize);
+				Loopback.CloseChannel(Channel);
+			}
+			Result.ExportSeconds = FPlatformTime::Seconds() - StartTime;
+			Result.CustomDataBytes = Loopback.FindChannel(ChannelName)->Num();
+
+			FLightmassSwarm Swarm(Loopback, FGuid::NewGuid(), 0);
+			FScene Scene;
+			{
+				const uint64 StartUsedPhysical = FPlatformMemory::GetStats().UsedPhysical;
+				StartTime = FPlatformTime::Seconds();
+				FLightmassImporter Importer(&Swarm);
+				verify(Swarm.OpenChannel(ChannelName, NSwarm::SWARM_JOB_CHANNEL_READ, true) >= 0);
+				Importer.ImportCustomData(Scene);
+				Swarm.CloseCurrentChannel();
+				Result.ImportSeconds = FPlatformTime::Seconds() - StartTime;
+				Result.ImportMemoryGrowth = int64(FPlatformMemory::GetStats().UsedPhysical) - int64(StartUsedPhysical);
+			}
+
+			if (Settings.ExportResults)
+			{
+				const int64 ExistingBytes = Loopback.GetTotalChannelSize();
+
+				StartTime = FPlatformTime::Seconds();
+				const FLightmassSolverExporter Exporter(&Swarm, Scene, false);
+				Settings.ExportResults(Exporter, SceneSize);
+				Result.ResultExportSeconds = FPlatformTime::Seconds() - StartTime;
+
+				Result.ResultBytes = Loopback.GetTotalChannelSize() - ExistingBytes;
+			}
+			return Result;
+		}
+	};
+}
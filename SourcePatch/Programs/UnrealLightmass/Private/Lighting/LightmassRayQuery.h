@@ -0,0 +1,216 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ExtensibilityCoreMinimal.h"
+#include "Collision.h"
+#include "Embree.h"
+#include "LightmassScene.h"
+
+namespace Lightmass
+{
+	struct FLightmassRay
+	{
+		FVector3f Origin;
+		float TNear = 0.f;
+		// Doesn't have to be normalized, T is measured in units of its length
+		FVector3f Direction;
+		float TFar = FLT_MAX;
+	};
+
+	/** T & Mesh are the same with either backend, the rest depends on FLightmassRayQuery::HasTriangleHits:
+	 *	- With Embree, PrimitiveIndex is the triangle index in the mesh, BarycentricUV its barycentrics & Normal the geometric normal.
+	 *	- The aggregate mesh fallback doesn't report the triangle, PrimitiveIndex is the mesh element index,
+	 *	  BarycentricUV stays zero & Normal is the interpolated shading normal. */
+	struct FLightmassRayHit
+	{
+		float T = FLT_MAX;
+		uint32 PrimitiveIndex = INDEX_NONE;
+		FVector2f BarycentricUV = FVector2f::ZeroVector;
+		// Not normalized
+		FVector3f Normal = FVector3f::ZeroVector;
+		const FStaticLightingMesh* Mesh = nullptr;
+
+		bool IsHit() const { return Mesh != nullptr; }
+	};
+
+	/** Batched ray queries against the scene's aggregate mesh for plugin tasks.
+	 * With Embree, each batch goes through a single ray stream call instead of one call per ray,
+	 * falls back to the aggregate mesh interface otherwise. Safe to use from multiple threads with one query each. */
+	class FLightmassRayQuery
+	{
+	public:
+		// Rays are sent to Embree in batches of this size, which keeps the ray structs on the stack
+		static constexpr int32 BatchSize = 256;
+
+		FLightmassRayQuery(const FScene& Scene, const FStaticLightingAggregateMesh& InAggregateMesh, const FStaticLightingMesh* InSkipMesh = nullptr)
+			: AggregateMesh(InAggregateMesh)
+			, SkipMesh(InSkipMesh)
+		{
+#if USE_EMBREE
+			// The verification mesh traces both ways, which defeats the purpose
+			if (Scene.EmbreeDevice && !Scene.bVerifyEmbree)
+			{
+				EmbreeScene = GetEmbreeScene(static_cast<const FEmbreeAggregateMesh&>(AggregateMesh));
+			}
+#endif
+		}
+
+		// Whether hits carry triangle data, see FLightmassRayHit
+		bool HasTriangleHits() const
+		{
+#if USE_EMBREE
+			return EmbreeScene != nullptr;
+#else
+			return false;
+#endif
+		}
+
+		/** Closest hits, OutHits should be as large as Rays */
+		void Intersect(TArrayView<const FLightmassRay> Rays, TArrayView<FLightmassRayHit> OutHits) const
+		{
+			check(OutHits.Num() >= Rays.Num());
+#if USE_EMBREE
+			if (EmbreeScene)
+			{
+				TraceEmbree(Rays, [&OutHits, this](int32 Index, const FEmbreeRay& Ray)
+				{
+					FLightmassRayHit& Hit = OutHits[Index];
+					if (Ray.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+					{
+						Hit = FLightmassRayHit();
+						return;
+					}
+					Hit.T = Ray.ray.tfar;
+					Hit.PrimitiveIndex = Ray.hit.primID;
+					Hit.BarycentricUV = FVector2f(Ray.hit.u, Ray.hit.v);
+					Hit.Normal = FVector3f(Ray.hit.Ng_x, Ray.hit.Ng_y, Ray.hit.Ng_z);
+					Hit.Mesh = static_cast<const FEmbreeGeometry*>(rtcGetGeometryUserData(rtcGetGeometry(EmbreeScene, Ray.hit.geomID)))->Mesh;
+				}, true);
+				return;
+			}
+#endif
+			for (int32 Index = 0; Index < Rays.Num(); ++Index)
+			{
+				FLightRayIntersection Intersection;
+				const FLightmassRay& Ray = Rays[Index];
+				FLightmassRayHit& Hit = OutHits[Index];
+				Hit = FLightmassRayHit();
+				if (TraceFallback(Ray, true, Intersection))
+				{
+					Hit.T = FVector3f::DotProduct(FVector3f(Intersection.IntersectionVertex.WorldPosition) - Ray.Origin, Ray.Direction) / Ray.Direction.SizeSquared();
+					Hit.PrimitiveIndex = Intersection.ElementIndex;
+					Hit.Normal = FVector3f(Intersection.IntersectionVertex.WorldTangentZ);
+					Hit.Mesh = Intersection.Mesh;
+				}
+			}
+		}
+
+		/** Any hit, for visibility & shadowing */
+		void Occluded(TArrayView<const FLightmassRay> Rays, TBitArray<>& OutOccluded) const
+		{
+			OutOccluded.Init(false, Rays.Num());
+#if USE_EMBREE
+			if (EmbreeScene)
+			{
+				TraceEmbree(Rays, [&OutOccluded](int32 Index, const FEmbreeRay& Ray)
+				{
+					// Embree marks occluded rays with a negative tfar
+					OutOccluded[Index] = Ray.ray.tfar < 0.f;
+				}, false);
+				return;
+			}
+#endif
+			for (int32 Index = 0; Index < Rays.Num(); ++Index)
+			{
+				FLightRayIntersection Intersection;
+				OutOccluded[Index] = TraceFallback(Rays[Index], false, Intersection);
+			}
+		}
+
+	private:
+#if USE_EMBREE
+		// Defined in ExtensibilityLightmass.cpp, the scene is private to the aggregate mesh
+		static RTCScene GetEmbreeScene(const FEmbreeAggregateMesh& Mesh);
+
+		template<typename CallbackType>
+		void TraceEmbree(TArrayView<const FLightmassRay> Rays, CallbackType&& Callback, bool bFindClosestIntersection) const
+		{
+			// Lightmass filter functions expect the extended FEmbreeRay, which Embree only hands over as is
+			// for incoherent streams. Coherent streams are repacked into SoA packets internally.
+			RTCIntersectContext Context;
+			rtcInitIntersectContext(&Context);
+			Context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+
+			TArray<FEmbreeRay, TInlineAllocator<BatchSize>> Batch;
+			for (int32 BatchStart = 0; BatchStart < Rays.Num(); BatchStart += BatchSize)
+			{
+				const int32 BatchNum = FMath::Min(BatchSize, Rays.Num() - BatchStart);
+				Batch.Reset();
+				for (int32 Index = 0; Index < BatchNum; ++Index)
+				{
+					const FLightmassRay& Ray = Rays[BatchStart + Index];
+					FEmbreeRay& EmbreeRay = Batch.Emplace_GetRef(SkipMesh, nullptr, LIGHTRAY_NONE, bFindClosestIntersection, false, false);
+					EmbreeRay.ray.org_x = Ray.Origin.X;
+					EmbreeRay.ray.org_y = Ray.Origin.Y;
+					EmbreeRay.ray.org_z = Ray.Origin.Z;
+					EmbreeRay.ray.dir_x = Ray.Direction.X;
+					EmbreeRay.ray.dir_y = Ray.Direction.Y;
+					EmbreeRay.ray.dir_z = Ray.Direction.Z;
+					EmbreeRay.ray.tnear = Ray.TNear;
+					EmbreeRay.ray.tfar = Ray.TFar;
+				}
+
+				if (bFindClosestIntersection)
+				{
+					rtcIntersect1M(EmbreeScene, &Context, Batch.GetData(), BatchNum, sizeof(FEmbreeRay));
+				}
+				else
+				{
+					rtcOccluded1M(EmbreeScene, &Context, &Batch.GetData()->ray, BatchNum, sizeof(FEmbreeRay));
+				}
+
+				for (int32 Index = 0; Index < BatchNum; ++Index)
+				{
+					Callback(BatchStart + Index, Batch[Index]);
+				}
+			}
+		}
+
+		RTCScene EmbreeScene = nullptr;
+#endif
+
+		bool TraceFallback(const FLightmassRay& Ray, bool bFindClosestIntersection, FLightRayIntersection& OutIntersection) const
+		{
+			const float DirectionSize = FMath::Max(Ray.Direction.Size(), UE_CONDITIONAL_ON_5_1(KINDA_SMALL_NUMBER, UE_KINDA_SMALL_NUMBER));
+			const float TFar = FMath::Min(Ray.TFar, UE_CONDITIONAL_ON_5_1(HALF_WORLD_MAX, UE_HALF_WORLD_MAX) / DirectionSize);
+			const FVector4f End(Ray.Origin + Ray.Direction * TFar, 0.f);
+
+			// The aggregate mesh only skips meshes for self shadowing, so hits on the skip mesh are stepped over like Embree's filter does.
+			// Any hit could land behind the occluders in front of it, so the closest one is needed to step over it.
+			float TNear = Ray.TNear;
+			while (TNear < TFar)
+			{
+				const FLightRay LightRay(FVector4f(Ray.Origin + Ray.Direction * TNear, 0.f), End, nullptr, nullptr);
+				AggregateMesh.IntersectLightRay(LightRay, bFindClosestIntersection || SkipMesh != nullptr, false, false, CoherentRayCache, OutIntersection);
+				if (!OutIntersection.bIntersects || OutIntersection.Mesh != SkipMesh)
+				{
+					return OutIntersection.bIntersects;
+				}
+
+				const float THit = FVector3f::DotProduct(FVector3f(OutIntersection.IntersectionVertex.WorldPosition) - Ray.Origin, Ray.Direction) / FMath::Square(DirectionSize);
+				TNear = FMath::Max(THit, TNear) + SkipDistance / DirectionSize;
+			}
+			OutIntersection.bIntersects = false;
+			return false;
+		}
+
+		// How far past a hit on the skip mesh tracing resumes
+		static constexpr float SkipDistance = 0.01f;
+
+		const FStaticLightingAggregateMesh& AggregateMesh;
+		const FStaticLightingMesh* SkipMesh;
+		mutable FCoherentRayCache CoherentRayCache;
+	};
+}
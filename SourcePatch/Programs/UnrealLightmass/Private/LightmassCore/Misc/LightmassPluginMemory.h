@@ -0,0 +1,244 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ExtensibilityCoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "HAL/LowLevelMemTracker.h"
+#include "HAL/PlatformMemory.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/RelaxedAtomicCounter.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/ScopeLock.h"
+#include "Serialization/MemoryWriter.h"
+#include "SwarmInterface.h"
+
+namespace Lightmass
+{
+	/** Memory accounting of a single plugin inside the Lightmass process, owned by the plugin module itself
+	 * so the numbers are shared between the executable and the plugin binaries. All sizes are in bytes. */
+	class FLightmassPluginMemory final : public FRunnable
+	{
+	public:
+		~FLightmassPluginMemory() override
+		{
+			if (SamplerThread)
+			{
+				SamplerThread->Kill(true);
+			}
+		}
+
+		void Initialize(const FString& InModuleName, int64 InBudget)
+		{
+			ModuleName = InModuleName;
+			Budget = InBudget;
+			LLMTag = FName(*FString::Printf(TEXT("LightmassPlugins/%s"), *ModuleName));
+			if (!SamplerThread)
+			{
+				SamplerThread.Reset(FRunnableThread::Create(this, *FString::Printf(TEXT("LightmassMemory %s"), *ModuleName), 64 * 1024, TPri_BelowNormal));
+			}
+		}
+
+		const FString& GetModuleName() const { return ModuleName; }
+
+		// Zero means unlimited, sent by the editor through FCustomLightmassExporter::SetPluginMemoryBudget
+		int64 GetBudget() const { return Budget; }
+
+		/** Explicit accounting for long-lived plugin data, e.g. imported scene structures or task scratch buffers */
+		void Track(int64 Delta)
+		{
+			UpdatePeak(Peak, Current.FetchAdd(Delta) + Delta);
+		}
+
+		/** Plugins should query this before taking a memory hungry path, and fall back to
+		 * streaming or any other low-memory alternative instead of risking the agent.
+		 * Counts the tracked bytes, or the process growth inside the active scopes if that's larger. */
+		bool ShouldUseLowMemoryPath(int64 RequestedBytes)
+		{
+			const int64 Usage = FMath::Max(Current.Get(), GetScopeUsage(FPlatformMemory::GetStats().UsedPhysical));
+			bool bLowMemory = Budget > 0 && Usage + RequestedBytes > Budget;
+			bLowMemory |= uint64(FMath::Max<int64>(RequestedBytes, 0)) > FPlatformMemory::GetStats().AvailablePhysical;
+			if (bLowMemory)
+			{
+				NumLowMemoryFallbacks++;
+			}
+			return bLowMemory;
+		}
+
+		int64 GetCurrent() const { return Current.Get(); }
+		int64 GetPeak() const { return Peak.Get(); }
+		int64 GetScopePeak() const { return ScopePeak.Get(); }
+		int32 GetNumLowMemoryFallbacks() const { return NumLowMemoryFallbacks.Get(); }
+
+		FString GetReport() const
+		{
+			return FString::Printf(TEXT("Plugin %s memory: tracked peak %.1f MB, sampled peak %.1f MB, budget %s, %d low-memory fallbacks"),
+				*ModuleName, Peak.Get() / 1048576.0, ScopePeak.Get() / 1048576.0,
+				Budget > 0 ? *FString::Printf(TEXT("%.1f MB"), Budget / 1048576.0) : TEXT("unlimited"),
+				NumLowMemoryFallbacks.Get());
+		}
+
+		// Samples the process memory while any scope is active, so short spikes show up in the scope peak too
+		uint32 Run() override
+		{
+			while (!bStopping.Get())
+			{
+				FPlatformProcess::Sleep(SampleInterval);
+				if (NumActiveScopes.Get() > 0)
+				{
+					UpdatePeak(ScopePeak, GetScopeUsage(FPlatformMemory::GetStats().UsedPhysical));
+				}
+			}
+			return 0;
+		}
+
+		void Stop() override { bStopping = true; }
+
+	private:
+		friend class FLightmassPluginMemoryScope;
+
+		static constexpr float SampleInterval = 0.01f;
+
+		static void UpdatePeak(TRelaxedAtomicCounter<int64>& InPeak, int64 Value)
+		{
+			int64 Expected = InPeak.Get();
+			while (Value > Expected && !InPeak.CompareAndSwapWeak(Expected, Value)) {}
+		}
+
+		int64 GetScopeUsage(uint64 UsedPhysical) const
+		{
+			return NumActiveScopes.Get() > 0 ? FMath::Max<int64>(int64(UsedPhysical) - ScopeBaseline.Get(), 0) : 0;
+		}
+
+		// Overlapping scopes, e.g. tasks on several threads, share the baseline of the first one
+		void BeginScope()
+		{
+			FScopeLock Lock(&ScopeCriticalSection);
+			if (NumActiveScopes.Get() == 0)
+			{
+				ScopeBaseline = int64(FPlatformMemory::GetStats().UsedPhysical);
+			}
+			NumActiveScopes++;
+		}
+
+		void EndScope()
+		{
+			FScopeLock Lock(&ScopeCriticalSection);
+			UpdatePeak(ScopePeak, GetScopeUsage(FPlatformMemory::GetStats().UsedPhysical));
+			NumActiveScopes--;
+		}
+
+		FString ModuleName;
+		FName LLMTag;
+		int64 Budget = 0;
+		TRelaxedAtomicCounter<int64> Current = 0;
+		TRelaxedAtomicCounter<int64> Peak = 0;
+		TRelaxedAtomicCounter<int64> ScopePeak = 0;
+		TRelaxedAtomicCounter<int32> NumLowMemoryFallbacks = 0;
+
+		FCriticalSection ScopeCriticalSection;
+		TRelaxedAtomicCounter<int32> NumActiveScopes = 0;
+		TRelaxedAtomicCounter<int64> ScopeBaseline = 0;
+		TUniquePtr<FRunnableThread> SamplerThread;
+		TRelaxedAtomicCounter<bool> bStopping = false;
+	};
+
+	/** Attributes the process memory used inside the scope to the plugin, and tags the allocations for LLM where available.
+	 * The peak is sampled periodically while the scope is active, exact for the single threaded import,
+	 * an upper bound for tasks running alongside other threads. */
+	class FLightmassPluginMemoryScope
+	{
+	public:
+		explicit FLightmassPluginMemoryScope(FLightmassPluginMemory& InMemory)
+			: Memory(InMemory)
+#if ENABLE_LOW_LEVEL_MEM_TRACKER && UE_VERSION_NEWER_THAN(5, 0, 0)
+			, LLMScope(InMemory.LLMTag, false, ELLMTagSet::None, ELLMTracker::Default)
+#endif
+		{
+			Memory.BeginScope();
+		}
+
+		~FLightmassPluginMemoryScope()
+		{
+			Memory.EndScope();
+		}
+
+	private:
+		FLightmassPluginMemory& Memory;
+#if ENABLE_LOW_LEVEL_MEM_TRACKER && UE_VERSION_NEWER_THAN(5, 0, 0)
+		FLLMScope LLMScope;
+#endif
+	};
+
+	/** Sends the memory report of every attached plugin to the editor once the job ends, in the job channel `CustomPluginMemory`.
+	 * Written by FLightmassImporter as it goes away, so plugins that only import are reported too. */
+	class FLightmassPluginMemoryReporter
+	{
+	public:
+		static constexpr uint32 Version = 1;
+		static constexpr const TCHAR* ChannelName = TEXT("CustomPluginMemory");
+
+		// The executable's instance, shared with plugin binaries by ILightmassPlugin::ShareSingletons
+		static FLightmassPluginMemoryReporter& Get()
+		{
+			FLightmassPluginMemoryReporter*& Shared = GetShared();
+			if (!Shared)
+			{
+				static FLightmassPluginMemoryReporter Instance;
+				Shared = &Instance;
+			}
+			return *Shared;
+		}
+
+		static void Share(FLightmassPluginMemoryReporter& Instance)
+		{
+			GetShared() = &Instance;
+		}
+
+		void Attach(FLightmassPluginMemory& Memory)
+		{
+			Memories.AddUnique(&Memory);
+		}
+
+		// Called on the main thread, the channel is only rewritten when the numbers changed.
+		// Templated as FLightmassSwarm isn't visible from the helpers
+		template<typename SwarmType>
+		void Export(SwarmType& Swarm)
+		{
+			if (!Memories.Num()) return;
+
+			TArray<uint8> Report;
+			FMemoryWriter Ar(Report);
+			uint32 ReportVersion = Version;
+			int32 NumMemories = Memories.Num();
+			Ar << ReportVersion << NumMemories;
+			for (const FLightmassPluginMemory* Memory : Memories)
+			{
+				FString Name = Memory->GetModuleName();
+				int64 Budget = Memory->GetBudget(), Peak = Memory->GetPeak(), ScopePeak = Memory->GetScopePeak();
+				int32 NumLowMemoryFallbacks = Memory->GetNumLowMemoryFallbacks();
+				Ar << Name << Budget << Peak << ScopePeak << NumLowMemoryFallbacks;
+			}
+			if (Report == LastReport) return;
+
+			if (Swarm.OpenChannel(ChannelName, NSwarm::SWARM_JOB_CHANNEL_WRITE, true) >= 0)
+			{
+				Swarm.Write(Report.GetData(), Report.Num());
+				Swarm.CloseCurrentChannel();
+				LastReport = MoveTemp(Report);
+			}
+		}
+
+	private:
+		static FLightmassPluginMemoryReporter*& GetShared()
+		{
+			static FLightmassPluginMemoryReporter* Shared = nullptr;
+			return Shared;
+		}
+
+		TArray<FLightmassPluginMemory*> Memories;
+		TArray<uint8> LastReport;
+	};
+}
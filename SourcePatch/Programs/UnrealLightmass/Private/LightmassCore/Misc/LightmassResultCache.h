@@ -0,0 +1,226 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "HAL/CriticalSection.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/RelaxedAtomicCounter.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Parse.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace Lightmass
+{
+	/** Local on-disk cache for deterministic custom task results, keyed by a hash of the task inputs.
+	 * Task data types opt in by providing the following members:
+	 *	uint64 ResultCacheKey;		// Hash of everything the result depends on, including a version. Zero bypasses the cache
+	 *	void Serialize(FArchive& Ar);	// The results only, the task Guid is always kept as is
+	 * Plugins should try Load before solving a task, and push hits to their complete task list as usual.
+	 * Misses are filled in automatically once the results go through FLightmassSolverExporter::ExportResults.
+	 * The size limit is 2 GB by default, -ResultCacheSize=<MB> overrides it, forwarded from the editor's -LightmassResultCacheSize=<MB>.
+	 * The hit & miss report is logged and sent to the editor when the job ends. */
+	class FLightmassResultCache
+	{
+		// ReSharper disable CppFunctionIsNotImplemented
+		template<typename T> static auto HasResultCacheKeyImpl(int) -> std::is_member_object_pointer<decltype(&T::ResultCacheKey)>;
+		template<typename T> static auto HasResultCacheKeyImpl(long) -> std::false_type;
+		// ReSharper restore CppFunctionIsNotImplemented
+	public:
+		template<typename T>
+		static constexpr bool HasResultCacheKey = decltype(HasResultCacheKeyImpl<T>(0))::value;
+
+		// The executable's instance, shared with plugin binaries by ILightmassPlugin::ShareSingletons so lookups & stores count together
+		static FLightmassResultCache& Get()
+		{
+			FLightmassResultCache*& Shared = GetShared();
+			if (!Shared)
+			{
+				static FLightmassResultCache Instance;
+				Shared = &Instance;
+			}
+			return *Shared;
+		}
+
+		static void Share(FLightmassResultCache& Instance)
+		{
+			GetShared() = &Instance;
+		}
+
+		// Least recently used entries are evicted once the cache grows beyond this
+		void SetMaxSize(int64 InMaxSize)
+		{
+			FScopeLock Lock(&CriticalSection);
+			MaxSize = InMaxSize;
+			EvictIfNeeded();
+		}
+
+		// The results in OutTaskData are only valid if it returns true, broken entries are deleted and count as misses
+		template<typename DataType>
+		bool Load(uint64 Key, DataType& OutTaskData)
+		{
+			static_assert(HasResultCacheKey<DataType>, "Task data type is not cacheable");
+			if (!Key) return false;
+
+			TArray<uint8> Bytes;
+			const FString Path = GetPath(Key);
+			if (!FFileHelper::LoadFileToArray(Bytes, *Path, FILEREAD_Silent))
+			{
+				Misses++;
+				return false;
+			}
+
+			// Truncated or stale entries, e.g. from a task data layout change without a version bump, are rejected
+			FMemoryReader Ar(Bytes);
+			const FGuid Guid = OutTaskData.Guid;
+			bool bValid = false;
+			if (Bytes.Num() >= sizeof(FEntryHeader))
+			{
+				FEntryHeader Header;
+				Ar.Serialize(&Header, sizeof(Header));
+				if (Header.Magic == FEntryHeader::MagicValue && Header.Key == Key)
+				{
+					OutTaskData.Serialize(Ar);
+					bValid = !Ar.IsError() && Ar.Tell() == Ar.TotalSize();
+				}
+			}
+
+			OutTaskData.Guid = Guid;
+			if (!bValid)
+			{
+				if (IFileManager::Get().Delete(*Path, false, false, true))
+				{
+					FScopeLock Lock(&CriticalSection);
+					TotalSize -= Bytes.Num();
+				}
+				Misses++;
+				return false;
+			}
+			OutTaskData.ResultCacheKey = Key;
+
+			// Keep recently used entries at the back of the eviction order
+			IFileManager::Get().SetTimeStamp(*Path, FDateTime::UtcNow());
+			Hits++;
+			return true;
+		}
+
+		template<typename DataType>
+		void Store(const DataType& TaskData)
+		{
+			if constexpr (HasResultCacheKey<DataType>)
+			{
+				// Identical inputs give identical results, existing entries are already up to date
+				const uint64 Key = TaskData.ResultCacheKey;
+				const FString Path = GetPath(Key);
+				if (!Key || IFileManager::Get().FileExists(*Path)) return;
+
+				TArray<uint8> Bytes;
+				FMemoryWriter Ar(Bytes);
+				FEntryHeader Header{ FEntryHeader::MagicValue, Key };
+				Ar.Serialize(&Header, sizeof(Header));
+				const_cast<DataType&>(TaskData).Serialize(Ar);
+
+				// Write to a temporary file first so other agents sharing the directory never read partial entries
+				const FString TempPath = Path + FString::Printf(TEXT(".%u.tmp"), FPlatformProcess::GetCurrentProcessId());
+				if (!FFileHelper::SaveArrayToFile(Bytes, *TempPath) || !IFileManager::Get().Move(*Path, *TempPath, true, true, false, true))
+				{
+					IFileManager::Get().Delete(*TempPath, false, false, true);
+					return;
+				}
+
+				FScopeLock Lock(&CriticalSection);
+				TotalSize += Bytes.Num();
+				Stores++;
+				EvictIfNeeded();
+			}
+		}
+
+		FString GetReport() const
+		{
+			const int32 NumLookups = Hits.Get() + Misses.Get();
+			return FString::Printf(TEXT("Result cache: %d hits, %d misses (%.1f%% hit rate), %d stored, %d evicted, %.1f MB on disk"),
+				Hits.Get(), Misses.Get(), NumLookups ? Hits.Get() * 100.f / NumLookups : 0.f, Stores.Get(), Evictions.Get(), TotalSize / 1048576.0);
+		}
+
+	private:
+		struct FEntryHeader
+		{
+			static constexpr uint64 MagicValue = 0x4C4D524553554C54; // LMRESULT
+			uint64 Magic;
+			uint64 Key;
+		};
+
+		FLightmassResultCache()
+			: Directory(FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("LightmassResultCache")))
+		{
+			IFileManager::Get().MakeDirectory(*Directory, true);
+			IFileManager::Get().IterateDirectoryStat(*Directory, [this](const TCHAR*, const FFileStatData& StatData)
+			{
+				if (!StatData.bIsDirectory) TotalSize += StatData.FileSize;
+				return true;
+			});
+
+			int32 MaxSizeMB = 0;
+			if (FParse::Value(FCommandLine::Get(), TEXT("-ResultCacheSize="), MaxSizeMB) && MaxSizeMB > 0)
+			{
+				MaxSize = int64(MaxSizeMB) << 20;
+			}
+		}
+
+		static FLightmassResultCache*& GetShared()
+		{
+			static FLightmassResultCache* Shared = nullptr;
+			return Shared;
+		}
+
+		FString GetPath(uint64 Key) const
+		{
+			return FPaths::Combine(Directory, FString::Printf(TEXT("%016llx.bin"), Key));
+		}
+
+		// Called with the lock held
+		void EvictIfNeeded()
+		{
+			if (TotalSize <= MaxSize) return;
+
+			struct FEntry { FString Path; int64 Size; FDateTime Time; };
+			TArray<FEntry> Entries;
+			IFileManager::Get().IterateDirectoryStat(*Directory, [&Entries](const TCHAR* Path, const FFileStatData& StatData)
+			{
+				if (!StatData.bIsDirectory && FPaths::GetExtension(Path) == TEXT("bin"))
+				{
+					Entries.Add({ Path, StatData.FileSize, StatData.ModificationTime });
+				}
+				return true;
+			});
+			Entries.Sort([](const FEntry& A, const FEntry& B) { return A.Time < B.Time; });
+
+			// Leave some headroom so we don't go through the directory on every store
+			const int64 TargetSize = MaxSize - MaxSize / 10;
+			for (const FEntry& Entry : Entries)
+			{
+				if (TotalSize <= TargetSize) break;
+				if (IFileManager::Get().Delete(*Entry.Path, false, false, true))
+				{
+					TotalSize -= Entry.Size;
+					Evictions++;
+				}
+			}
+		}
+
+		FString Directory;
+		FCriticalSection CriticalSection;
+		int64 MaxSize = 2ll << 30;
+		int64 TotalSize = 0;
+
+		TRelaxedAtomicCounter<int32> Hits = 0;
+		TRelaxedAtomicCounter<int32> Misses = 0;
+		TRelaxedAtomicCounter<int32> Stores = 0;
+		TRelaxedAtomicCounter<int32> Evictions = 0;
+	};
+}
@@ -0,0 +1,275 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "Containers/ContainerAllocationPolicies.h"
+#include "HAL/UnrealMemory.h"
+
+namespace Lightmass
+{
+	/** Bump allocator for plugin scene data: allocations are packed into large blocks and only ever freed
+	 * all at once on Release, so importing millions of small objects costs a handful of system allocations.
+	 * Not thread safe, meant to be filled during ILightmassPlugin::Import, which releases the previous scene's data first. */
+	class FLightmassSceneArena
+	{
+	public:
+		explicit FLightmassSceneArena(SIZE_T InBlockSize = 1 << 20)
+			: BlockSize(InBlockSize)
+		{}
+
+		~FLightmassSceneArena() { Release(); }
+
+		FLightmassSceneArena(const FLightmassSceneArena&) = delete;
+		FLightmassSceneArena& operator=(const FLightmassSceneArena&) = delete;
+
+		void* Allocate(SIZE_T Size, SIZE_T Alignment = DEFAULT_ALIGNMENT)
+		{
+			Alignment = FMath::Max<SIZE_T>(Alignment, alignof(void*));
+			uint8* Result = Align(Cursor, Alignment);
+			if (!Cursor || Result + Size > End)
+			{
+				const SIZE_T NeededSize = sizeof(FBlock) + Size + Alignment;
+				if (Cursor && NeededSize > BlockSize)
+				{
+					// Oversized allocations get a block of their own, so the room left in the current one is not wasted
+					UsedSize += Size;
+					return Align(reinterpret_cast<uint8*>(AllocateBlock(NeededSize) + 1), Alignment);
+				}
+
+				const SIZE_T NewBlockSize = FMath::Max(BlockSize, NeededSize);
+				FBlock* Block = AllocateBlock(NewBlockSize);
+				Cursor = reinterpret_cast<uint8*>(Block + 1);
+				End = reinterpret_cast<uint8*>(Block) + NewBlockSize;
+				Result = Align(Cursor, Alignment);
+			}
+
+			Cursor = Result + Size;
+			UsedSize += Size;
+			return Result;
+		}
+
+		/** Typed allocation, destructors are run on Release in reverse order of construction */
+		template<typename T, typename... ArgTypes>
+		T* New(ArgTypes&&... Args)
+		{
+			T* Object = new(Allocate(sizeof(T), alignof(T))) T(Forward<ArgTypes>(Args)...);
+			if constexpr (!std::is_trivially_destructible_v<T>)
+			{
+				FDestructor* Destructor = new(Allocate(sizeof(FDestructor), alignof(FDestructor))) FDestructor;
+				Destructor->Object = Object;
+				Destructor->Destruct = [](void* InObject) { static_cast<T*>(InObject)->~T(); };
+				Destructor->Next = Destructors;
+				Destructors = Destructor;
+			}
+			return Object;
+		}
+
+		/** Default constructed array, which has to be trivially destructible since it is never destroyed element by element */
+		template<typename T>
+		TArrayView<T> NewArray(int32 Num)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "Use New or TSceneArenaArray for types with destructors");
+			T* Data = static_cast<T*>(Allocate(sizeof(T) * Num, alignof(T)));
+			for (int32 Index = 0; Index < Num; ++Index)
+			{
+				new(Data + Index) T();
+			}
+			return MakeArrayView(Data, Num);
+		}
+
+		void Release()
+		{
+			for (FDestructor* Destructor = Destructors; Destructor; Destructor = Destructor->Next)
+			{
+				Destructor->Destruct(Destructor->Object);
+			}
+			Destructors = nullptr;
+
+			while (Blocks)
+			{
+				FBlock* Next = Blocks->Next;
+				FMemory::Free(Blocks);
+				Blocks = Next;
+			}
+			Cursor = End = nullptr;
+			UsedSize = ReservedSize = 0;
+		}
+
+		SIZE_T GetUsedSize() const { return UsedSize; }
+		SIZE_T GetReservedSize() const { return ReservedSize; }
+
+		/** Containers using TSceneArenaAllocator allocate from the innermost arena in scope on their thread */
+		static FLightmassSceneArena* GetCurrent() { return GetCurrentRef(); }
+
+		class FScope
+		{
+		public:
+			explicit FScope(FLightmassSceneArena& Arena)
+				: Previous(GetCurrentRef())
+			{
+				GetCurrentRef() = &Arena;
+			}
+
+			~FScope() { GetCurrentRef() = Previous; }
+
+		private:
+			FLightmassSceneArena* Previous;
+		};
+
+	private:
+		struct alignas(16) FBlock
+		{
+			FBlock* Next;
+		};
+
+		struct FDestructor
+		{
+			void* Object;
+			void (*Destruct)(void*);
+			FDestructor* Next;
+		};
+
+		FBlock* AllocateBlock(SIZE_T Size)
+		{
+			FBlock* Block = static_cast<FBlock*>(FMemory::Malloc(Size, alignof(FBlock)));
+			Block->Next = Blocks;
+			Blocks = Block;
+			ReservedSize += Size;
+			return Block;
+		}
+
+		// One per binary, scopes are always opened by the plugin itself, see ILightmassPlugin::ImportWithSceneArena
+		static FLightmassSceneArena*& GetCurrentRef()
+		{
+			static thread_local FLightmassSceneArena* Current = nullptr;
+			return Current;
+		}
+
+		SIZE_T BlockSize;
+		FBlock* Blocks = nullptr;
+		uint8* Cursor = nullptr;
+		uint8* End = nullptr;
+		FDestructor* Destructors = nullptr;
+		SIZE_T UsedSize = 0;
+		SIZE_T ReservedSize = 0;
+	};
+
+	/** Container allocation policy on top of the arena in scope when the container is constructed.
+	 * Growing leaves the previous allocation behind until the arena is released, so reserve up front where possible.
+	 * Containers constructed outside any FLightmassSceneArena::FScope, e.g. copies made by tasks, fall back to the heap.
+	 * Moving takes over the source's arena or heap allocation along with the data. */
+	template<uint32 Alignment = DEFAULT_ALIGNMENT>
+	class TSceneArenaAllocator
+	{
+	public:
+		using SizeType = int32;
+
+		enum { NeedsElementType = true };
+		enum { RequireRangeCheck = true };
+
+		template<typename ElementType>
+		class ForElementType
+		{
+		public:
+			ForElementType()
+				: Arena(FLightmassSceneArena::GetCurrent())
+			{}
+
+			~ForElementType()
+			{
+				if (!Arena && Data)
+				{
+					FMemory::Free(Data);
+				}
+			}
+
+			FORCEINLINE void MoveToEmpty(ForElementType& Other)
+			{
+				checkSlow(this != &Other);
+				if (!Arena && Data)
+				{
+					FMemory::Free(Data);
+				}
+				Data = Other.Data;
+				Arena = Other.Arena;
+				Other.Data = nullptr;
+			}
+
+			FORCEINLINE ElementType* GetAllocation() const
+			{
+				return Data;
+			}
+
+			void ResizeAllocation(SizeType PreviousNumElements, SizeType NumElements, SIZE_T NumBytesPerElement)
+			{
+				if (!Arena)
+				{
+					if (Data || NumElements)
+					{
+						Data = static_cast<ElementType*>(FMemory::Realloc(Data, NumElements * NumBytesPerElement, FMath::Max<uint32>(Alignment, alignof(ElementType))));
+					}
+					return;
+				}
+
+				ElementType* OldData = Data;
+				Data = nullptr;
+				if (NumElements)
+				{
+					Data = static_cast<ElementType*>(Arena->Allocate(NumElements * NumBytesPerElement, FMath::Max<uint32>(Alignment, alignof(ElementType))));
+					if (OldData && PreviousNumElements)
+					{
+						FMemory::Memcpy(Data, OldData, FMath::Min(NumElements, PreviousNumElements) * NumBytesPerElement);
+					}
+				}
+			}
+
+			FORCEINLINE SizeType CalculateSlackReserve(SizeType NumElements, SIZE_T NumBytesPerElement) const
+			{
+				return DefaultCalculateSlackReserve(NumElements, NumBytesPerElement, false, Alignment);
+			}
+
+			FORCEINLINE SizeType CalculateSlackShrink(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+			{
+				// Shrinking would only waste more of the arena
+				return Arena ? NumAllocatedElements : DefaultCalculateSlackShrink(NumElements, NumAllocatedElements, NumBytesPerElement, true, Alignment);
+			}
+
+			FORCEINLINE SizeType CalculateSlackGrow(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+			{
+				return DefaultCalculateSlackGrow(NumElements, NumAllocatedElements, NumBytesPerElement, false, Alignment);
+			}
+
+			FORCEINLINE SIZE_T GetAllocatedSize(SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+			{
+				return NumAllocatedElements * NumBytesPerElement;
+			}
+
+			FORCEINLINE bool HasAllocation() const
+			{
+				return !!Data;
+			}
+
+			FORCEINLINE SizeType GetInitialCapacity() const
+			{
+				return 0;
+			}
+
+		private:
+			ElementType* Data = nullptr;
+			// Null for heap allocations
+			FLightmassSceneArena* Arena;
+		};
+
+		typedef void ForAnyElementType;
+	};
+
+	template<typename T>
+	using TSceneArenaArray = TArray<T, TSceneArenaAllocator<>>;
+}
+
+template<uint32 Alignment>
+struct TAllocatorTraits<Lightmass::TSceneArenaAllocator<Alignment>> : TAllocatorTraitsBase<Lightmass::TSceneArenaAllocator<Alignment>>
+{
+	enum { SupportsMove = true };
+};
@@ -0,0 +1,180 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "HAL/CriticalSection.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/RelaxedAtomicCounter.h"
+#include "Misc/ScopeLock.h"
+#include "Serialization/MemoryWriter.h"
+#include "SwarmInterface.h"
+
+namespace Lightmass
+{
+	/** Plain relaxed atomic, cheap enough to be updated from hot loops.
+	 * Use FBatch in the tightest ones so the shared cache line is only touched once per batch. */
+	class FLightmassTelemetryCounter
+	{
+	public:
+		void Add(int64 Delta) { Value.FetchAdd(Delta); }
+		// Expected final value, enables the ETA in the editor
+		void SetTotal(int64 InTotal) { Total = InTotal; }
+
+		class FBatch
+		{
+		public:
+			explicit FBatch(FLightmassTelemetryCounter& InCounter) : Counter(InCounter) {}
+			~FBatch() { Counter.Add(Pending); }
+			void Add(int64 Delta) { Pending += Delta; }
+
+		private:
+			FLightmassTelemetryCounter& Counter;
+			int64 Pending = 0;
+		};
+
+	private:
+		friend class FLightmassTelemetryPublisher;
+
+		FString Name;
+		TRelaxedAtomicCounter<int64> Value = 0;
+		TRelaxedAtomicCounter<int64> Total = 0;
+	};
+
+	/** Counters registered by a plugin, owned by the plugin module. Published to the editor by FLightmassTelemetryPublisher. */
+	class FLightmassTelemetry
+	{
+	public:
+		~FLightmassTelemetry();
+
+		// The returned counter stays valid for the lifetime of the plugin module
+		FLightmassTelemetryCounter& RegisterCounter(const FString& Name, int64 Total = 0)
+		{
+			FScopeLock Lock(&CriticalSection);
+			TUniquePtr<FLightmassTelemetryCounter>& Counter = Counters.Emplace_GetRef(MakeUnique<FLightmassTelemetryCounter>());
+			Counter->Name = Name;
+			Counter->SetTotal(Total);
+			return *Counter;
+		}
+
+	private:
+		friend class FLightmassTelemetryPublisher;
+
+		FCriticalSection CriticalSection;
+		FString ModuleName;
+		TArray<TUniquePtr<FLightmassTelemetryCounter>> Counters;
+		// The publisher this is attached to, if any
+		class FLightmassTelemetryPublisher* Publisher = nullptr;
+	};
+
+	/** Writes snapshots of every attached plugin's counters to the job channel `CustomTelemetry`, which the editor polls during the build.
+	 * Polled from the main loop as the complete task lists are drained, whether or not a task completed, and published at most once per interval,
+	 * through the same Swarm wrapper so the loopback sees them too. A last snapshot is forced when the job ends.
+	 * Each snapshot overwrites the previous one and ends with its sequence number, so the editor can tell a complete one. */
+	class FLightmassTelemetryPublisher
+	{
+	public:
+		static constexpr uint32 Version = 2;
+		static constexpr const TCHAR* ChannelName = TEXT("CustomTelemetry");
+
+		// The executable's instance, shared with plugin binaries by ILightmassPlugin::ShareSingletons as the task lists are drained from there
+		static FLightmassTelemetryPublisher& Get()
+		{
+			FLightmassTelemetryPublisher*& Shared = GetShared();
+			if (!Shared)
+			{
+				static FLightmassTelemetryPublisher Instance;
+				Shared = &Instance;
+			}
+			return *Shared;
+		}
+
+		static void Share(FLightmassTelemetryPublisher& Instance)
+		{
+			GetShared() = &Instance;
+		}
+
+		void Attach(FLightmassTelemetry& Telemetry, const FString& ModuleName)
+		{
+			FScopeLock Lock(&CriticalSection);
+			Telemetry.ModuleName = ModuleName;
+			Telemetry.Publisher = this;
+			Telemetries.AddUnique(&Telemetry);
+			if (StartTime == 0.0)
+			{
+				StartTime = FPlatformTime::Seconds();
+			}
+		}
+
+		void Detach(FLightmassTelemetry& Telemetry)
+		{
+			FScopeLock Lock(&CriticalSection);
+			Telemetries.Remove(&Telemetry);
+			Telemetry.Publisher = nullptr;
+		}
+
+		// Called on the main thread, plugins with a main loop of their own can poll it from there too.
+		// Templated as FLightmassSwarm isn't visible from the helpers
+		template<typename SwarmType>
+		void Publish(SwarmType& Swarm, bool bForce = false)
+		{
+			FScopeLock Lock(&CriticalSection);
+			const double Now = FPlatformTime::Seconds();
+			if (!Telemetries.Num() || (!bForce && Now - LastPublishTime < Interval)) return;
+			LastPublishTime = Now;
+
+			TArray<uint8> Snapshot;
+			FMemoryWriter Ar(Snapshot);
+			uint32 SnapshotVersion = Version;
+			int32 Sequence = NextSequence;
+			double Time = Now - StartTime;
+			int32 NumCounters = 0;
+			for (FLightmassTelemetry* Telemetry : Telemetries) NumCounters += Telemetry->Counters.Num();
+			if (!NumCounters) return;
+			Ar << SnapshotVersion << Sequence << Time << NumCounters;
+
+			for (FLightmassTelemetry* Telemetry : Telemetries)
+			{
+				FScopeLock TelemetryLock(&Telemetry->CriticalSection);
+				for (const TUniquePtr<FLightmassTelemetryCounter>& Counter : Telemetry->Counters)
+				{
+					FString Name = Telemetry->ModuleName / Counter->Name;
+					int64 Value = Counter->Value.Get(), Total = Counter->Total.Get();
+					Ar << Name << Value << Total;
+				}
+			}
+			// Marks the snapshot as complete, the editor skips it until this is in
+			Ar << Sequence;
+
+			if (Swarm.OpenChannel(ChannelName, NSwarm::SWARM_JOB_CHANNEL_WRITE, true) >= 0)
+			{
+				Swarm.Write(Snapshot.GetData(), Snapshot.Num());
+				Swarm.CloseCurrentChannel();
+				NextSequence++;
+			}
+		}
+
+	private:
+		static FLightmassTelemetryPublisher*& GetShared()
+		{
+			static FLightmassTelemetryPublisher* Shared = nullptr;
+			return Shared;
+		}
+
+		FCriticalSection CriticalSection;
+		TArray<FLightmassTelemetry*> Telemetries;
+		double StartTime = 0.0;
+		double LastPublishTime = 0.0;
+		double Interval = 1.0;
+		int32 NextSequence = 0;
+	};
+
+	inline FLightmassTelemetry::~FLightmassTelemetry()
+	{
+		// Plugin modules are unloaded at shutdown, before the executable's publisher goes away
+		if (Publisher)
+		{
+			Publisher->Detach(*this);
+		}
+	}
+}
@@ -0,0 +1,260 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ExtensibilityCoreMinimal.h"
+#if UE_VERSION_OLDER_THAN(5, 0, 0)
+#include "Math/Float16.h"
+#endif
+
+/** Compact structure-of-arrays streams for engine vectors, normals, UVs etc.
+ * Written by the exporter in a single buffer, and read in place on the Lightmass side. */
+enum class EPackedVectorFormat : uint8
+{
+	Float32,
+	Float16,
+	// Normalized to the per-component range of the stream
+	Quantized16,
+};
+
+struct FPackedVectorStreamHeader
+{
+	uint32 Num;
+	uint8 NumComponents;
+	EPackedVectorFormat Format;
+	uint16 Reserved[5];
+	float Min[4];
+	float Scale[4];
+};
+static_assert(sizeof(FPackedVectorStreamHeader) % 16 == 0, "Lanes following the header have to stay aligned");
+
+class FPackedVectorStream
+{
+public:
+	static constexpr uint32 Alignment = 16;
+
+	static uint32 GetElementSize(EPackedVectorFormat Format)
+	{
+		return Format == EPackedVectorFormat::Float32 ? sizeof(float) : sizeof(uint16);
+	}
+
+	static uint32 GetLaneStride(uint32 Num, EPackedVectorFormat Format)
+	{
+		const uint32 ElementsPerBlock = Alignment / GetElementSize(Format);
+		return Align(Num, ElementsPerBlock);
+	}
+
+	static uint64 GetPackedSize(uint32 Num, uint32 NumComponents, EPackedVectorFormat Format)
+	{
+		return sizeof(FPackedVectorStreamHeader) + uint64(GetLaneStride(Num, Format)) * GetElementSize(Format) * NumComponents;
+	}
+
+	/** Appends the packed stream to the output buffer, which should be written to the channel as is.
+	 * The stream starts at the next 16 byte offset, so streams packed back to back keep their lanes aligned.
+	 * Works with any float or double vector type with an operator[], e.g. FVector3d, FVector2f, FVector4.
+	 * Returns false and leaves the buffer untouched if the stream doesn't fit in it. */
+	template<typename VectorType>
+	static bool Pack(TArrayView<const VectorType> Vectors, EPackedVectorFormat Format, TArray<uint8>& Out)
+	{
+		using ComponentType = std::decay_t<decltype(Vectors[0][0])>;
+		constexpr uint32 NumComponents = sizeof(VectorType) / sizeof(ComponentType);
+		static_assert(NumComponents <= 4, "Only up to 4 components are supported");
+
+		const uint32 Num = Vectors.Num();
+		const uint32 LaneStride = GetLaneStride(Num, Format);
+
+		// Heap allocations are at least 16 byte aligned, so are the lanes as long as the offset is
+		const uint64 Offset = Align(uint64(Out.Num()), uint64(Alignment));
+		const uint64 PackedSize = GetPackedSize(Num, NumComponents, Format);
+		if (!ensureMsgf(Offset + PackedSize <= uint64(MAX_int32), TEXT("Packed vector stream of %u elements doesn't fit in the buffer"), Num))
+		{
+			return false;
+		}
+		Out.AddZeroed(static_cast<int32>(Offset + PackedSize) - Out.Num());
+
+		FPackedVectorStreamHeader& Header = *reinterpret_cast<FPackedVectorStreamHeader*>(Out.GetData() + Offset);
+		Header.Num = Num;
+		Header.NumComponents = NumComponents;
+		Header.Format = Format;
+		uint8* Lanes = Out.GetData() + Offset + sizeof(FPackedVectorStreamHeader);
+
+		// Narrow & transpose one lane at a time so the loops stay trivially vectorizable
+		TArray<float, TAlignedHeapAllocator<Alignment>> Lane;
+		Lane.SetNumUninitialized(LaneStride);
+		for (uint32 Component = 0; Component < NumComponents; ++Component)
+		{
+			for (uint32 Index = 0; Index < Num; ++Index)
+			{
+				Lane[Index] = static_cast<float>(Vectors[Index][Component]);
+			}
+			for (uint32 Index = Num; Index < LaneStride; ++Index)
+			{
+				Lane[Index] = 0.f;
+			}
+
+			uint8* LaneData = Lanes + uint64(Component) * LaneStride * GetElementSize(Format);
+			Header.Min[Component] = 0.f;
+			Header.Scale[Component] = 1.f;
+			switch (Format)
+			{
+			case EPackedVectorFormat::Float32:
+				FMemory::Memcpy(LaneData, Lane.GetData(), uint64(LaneStride) * sizeof(float));
+				break;
+			case EPackedVectorFormat::Float16:
+				EncodeHalf(Lane.GetData(), reinterpret_cast<uint16*>(LaneData), LaneStride);
+				break;
+			case EPackedVectorFormat::Quantized16:
+				EncodeQuantized(Lane.GetData(), Num, reinterpret_cast<uint16*>(LaneData), Header.Min[Component], Header.Scale[Component]);
+				break;
+			}
+		}
+		return true;
+	}
+
+	template<typename VectorType>
+	static TArray<uint8> Pack(TArrayView<const VectorType> Vectors, EPackedVectorFormat Format)
+	{
+		TArray<uint8> Out;
+		Pack(Vectors, Format, Out);
+		return Out;
+	}
+
+	// Num is expected to be a multiple of 4, which lane strides always are
+	static void EncodeHalf(const float* RESTRICT Src, uint16* RESTRICT Dst, uint32 Num)
+	{
+#if UE_VERSION_OLDER_THAN(5, 0, 0)
+		// No vectorized half conversions before 5.0
+		for (uint32 Index = 0; Index < Num; ++Index)
+		{
+			Dst[Index] = FFloat16(Src[Index]).Encoded;
+		}
+#else
+		for (uint32 Index = 0; Index < Num; Index += 4)
+		{
+			FPlatformMath::VectorStoreHalf(Dst + Index, Src + Index);
+		}
+#endif
+	}
+
+	static void DecodeHalf(const uint16* RESTRICT Src, float* RESTRICT Dst, uint32 Num)
+	{
+		uint32 Index = 0;
+#if !UE_VERSION_OLDER_THAN(5, 0, 0)
+		for (; Index + 4 <= Num; Index += 4)
+		{
+			FPlatformMath::VectorLoadHalf(Dst + Index, Src + Index);
+		}
+#endif
+		for (; Index < Num; ++Index)
+		{
+			Dst[Index] = LoadHalf(Src + Index);
+		}
+	}
+
+	static float LoadHalf(const uint16* Src)
+	{
+#if UE_VERSION_OLDER_THAN(5, 0, 0)
+		FFloat16 Half;
+		Half.Encoded = *Src;
+		return Half;
+#else
+		return FPlatformMath::LoadHalf(Src);
+#endif
+	}
+
+	static void EncodeQuantized(const float* RESTRICT Src, uint32 Num, uint16* RESTRICT Dst, float& OutMin, float& OutScale)
+	{
+		float Min = Num ? Src[0] : 0.f, Max = Min;
+		for (uint32 Index = 0; Index < Num; ++Index)
+		{
+			Min = FMath::Min(Min, Src[Index]);
+			Max = FMath::Max(Max, Src[Index]);
+		}
+
+		OutMin = Min;
+		OutScale = Max > Min ? (Max - Min) / MAX_uint16 : 1.f;
+		const float InvScale = 1.f / OutScale;
+		for (uint32 Index = 0; Index < Num; ++Index)
+		{
+			Dst[Index] = static_cast<uint16>(FMath::Clamp((Src[Index] - Min) * InvScale + 0.5f, 0.f, float(MAX_uint16)));
+		}
+	}
+};
+
+/** Zero-copy view over a packed stream, e.g. directly over the buffer imported from the channel. */
+class FPackedVectorStreamView
+{
+public:
+	FPackedVectorStreamView() = default;
+
+	explicit FPackedVectorStreamView(const uint8* InData)
+		: Header(reinterpret_cast<const FPackedVectorStreamHeader*>(InData))
+		, LaneStride(FPackedVectorStream::GetLaneStride(Header->Num, Header->Format))
+	{
+		checkf(IsAligned(InData, alignof(float)), TEXT("Packed vector streams need to be at least float aligned"));
+	}
+
+	int32 Num() const { return Header ? Header->Num : 0; }
+	int32 GetNumComponents() const { return Header ? Header->NumComponents : 0; }
+	EPackedVectorFormat GetFormat() const { return Header->Format; }
+	uint64 GetPackedSize() const { return FPackedVectorStream::GetPackedSize(Header->Num, Header->NumComponents, Header->Format); }
+
+	// Float32 streams can be consumed in place
+	TArrayView<const float> GetFloatLane(int32 Component) const
+	{
+		check(Header->Format == EPackedVectorFormat::Float32);
+		return MakeArrayView(reinterpret_cast<const float*>(GetLaneData(Component)), Header->Num);
+	}
+
+	float Get(int32 Index, int32 Component) const
+	{
+		checkSlow(Index < Num() && Component < GetNumComponents());
+		const uint8* Lane = GetLaneData(Component);
+		switch (Header->Format)
+		{
+		case EPackedVectorFormat::Float32: return reinterpret_cast<const float*>(Lane)[Index];
+		case EPackedVectorFormat::Float16: return FPackedVectorStream::LoadHalf(reinterpret_cast<const uint16*>(Lane) + Index);
+		default: return Header->Min[Component] + reinterpret_cast<const uint16*>(Lane)[Index] * Header->Scale[Component];
+		}
+	}
+
+	UE_CONDITIONAL_ON_5_0(FVector2D, FVector2f) GetVector2f(int32 Index) const { return { Get(Index, 0), Get(Index, 1) }; }
+	UE_CONDITIONAL_ON_5_0(FVector, FVector3f) GetVector3f(int32 Index) const { return { Get(Index, 0), Get(Index, 1), Get(Index, 2) }; }
+	UE_CONDITIONAL_ON_5_0(FVector4, FVector4f) GetVector4f(int32 Index) const { return { Get(Index, 0), Get(Index, 1), Get(Index, 2), Get(Index, 3) }; }
+
+	/** Batch decode part of a lane into floats */
+	void DecodeLane(int32 Component, int32 Start, int32 Count, float* Out) const
+	{
+		check(Start >= 0 && Start + Count <= Num());
+		const uint8* Lane = GetLaneData(Component);
+		switch (Header->Format)
+		{
+		case EPackedVectorFormat::Float32:
+			FMemory::Memcpy(Out, reinterpret_cast<const float*>(Lane) + Start, Count * sizeof(float));
+			break;
+		case EPackedVectorFormat::Float16:
+			FPackedVectorStream::DecodeHalf(reinterpret_cast<const uint16*>(Lane) + Start, Out, Count);
+			break;
+		case EPackedVectorFormat::Quantized16:
+		{
+			const uint16* Src = reinterpret_cast<const uint16*>(Lane) + Start;
+			const float Min = Header->Min[Component], Scale = Header->Scale[Component];
+			for (int32 Index = 0; Index < Count; ++Index)
+			{
+				Out[Index] = Min + Src[Index] * Scale;
+			}
+			break;
+		}
+		}
+	}
+
+private:
+	const uint8* GetLaneData(int32 Component) const
+	{
+		return reinterpret_cast<const uint8*>(Header + 1) + uint64(Component) * LaneStride * FPackedVectorStream::GetElementSize(Header->Format);
+	}
+
+	const FPackedVectorStreamHeader* Header = nullptr;
+	uint32 LaneStride = 0;
+};
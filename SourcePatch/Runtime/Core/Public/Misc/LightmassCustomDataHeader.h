@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: 2024 Yun Hsiao Wu <yunhsiaow@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ExtensibilityCoreMinimal.h"
+
+/** The section every Lightmass custom data channel starts with, ahead of the plugin payloads.
+ * Written by FLightmassExporter::WriteCustomData and the loopback benchmark, read by FLightmassImporter::ImportCustomData:
+ *	int32 NameLength, TCHAR DependentPluginModules[NameLength] (null terminated), int64 MemoryBudgets[NumModules] */
+struct FLightmassCustomDataHeader
+{
+	// "Plugin:Module" pairs separated by spaces, same format as FLightmassExporter::DependentPluginModules
+	FString DependentPluginModules;
+	// One per module in order, zero means unlimited
+	TArray<int64> MemoryBudgets;
+
+	// The "Plugin:Module" pairs
+	TArray<FString> GetModules() const
+	{
+		TArray<FString> Modules;
+		DependentPluginModules.ParseIntoArray(Modules, TEXT(" "));
+		return Modules;
+	}
+
+	// WriteData(const void* Data, int32 Size), e.g. wrapping NSwarm::FSwarmInterface::WriteChannel
+	template<typename WriteFunctionType>
+	void Write(WriteFunctionType&& WriteData) const
+	{
+		check(MemoryBudgets.Num() == GetModules().Num());
+		const int32 NameLength = DependentPluginModules.GetCharArray().Num();
+		WriteData(&NameLength, static_cast<int32>(sizeof(NameLength)));
+		if (NameLength) WriteData(*DependentPluginModules, NameLength * static_cast<int32>(sizeof(TCHAR)));
+		if (MemoryBudgets.Num()) WriteData(MemoryBudgets.GetData(), MemoryBudgets.Num() * static_cast<int32>(sizeof(int64)));
+	}
+
+	// ReadData(void* Data, int32 Size), e.g. wrapping FLightmassSwarm::Read
+	template<typename ReadFunctionType>
+	bool Read(ReadFunctionType&& ReadData)
+	{
+		int32 NameLength = 0;
+		ReadData(&NameLength, static_cast<int32>(sizeof(NameLength)));
+		if (NameLength < 0) return false;
+
+		TArray<TCHAR> Name;
+		Name.SetNumUninitialized(NameLength);
+		if (NameLength) ReadData(Name.GetData(), NameLength * static_cast<int32>(sizeof(TCHAR)));
+		if (NameLength && Name.Last() != TEXT('\0')) return false;
+		DependentPluginModules = NameLength ? FString(Name.GetData()) : FString();
+
+		MemoryBudgets.SetNumZeroed(GetModules().Num());
+		if (MemoryBudgets.Num()) ReadData(MemoryBudgets.GetData(), MemoryBudgets.Num() * static_cast<int32>(sizeof(int64)));
+		return true;
+	}
+};
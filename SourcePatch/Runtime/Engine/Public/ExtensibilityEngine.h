@@ -3,8 +3,10 @@
 
 #pragma once
 
+#include "UObject/UObjectArray.h"
 #include "UObject/UObjectBaseUtility.h"
 #include "GameFramework/Actor.h"
+#include "Engine/World.h"
 #include "ExtensibilityCore.h"
 
 inline void MarkAsGarbage(UObject* Object)
@@ -24,3 +26,79 @@ inline void MarkComponentsAsGarbage(AActor* Actor)
 	Actor->MarkComponentsAsGarbage();
 #endif
 }
+
+/** Destroys large numbers of transient helper actors in bulk, and collects them with a single GC at a chosen point.
+ * Each actor still goes through UWorld::DestroyActor (EndPlay, Destroyed, detachment & editor notifications),
+ * only the garbage collection is batched. Levels are left unmodified. */
+class FDeferredActorTeardown
+{
+public:
+	struct FStats
+	{
+		int32 NumActors = 0;
+		int32 NumComponents = 0;
+		double DestroySeconds = 0.0;
+		double CollectSeconds = 0.0;
+		// UObjects freed by the collections, not only the actors & components added here
+		int32 NumCollectedObjects = 0;
+		// Drop in used physical memory across the collections, allocator caches may keep some of it
+		int64 ReclaimedBytes = 0;
+	};
+
+	void Add(AActor* Actor)
+	{
+		if (IsValid(Actor)) PendingActors.Add(Actor);
+	}
+
+	void Append(TArrayView<AActor* const> Actors)
+	{
+		PendingActors.Reserve(PendingActors.Num() + Actors.Num());
+		for (AActor* Actor : Actors) Add(Actor);
+	}
+
+	// Destroys everything added so far, cheap enough to be called after each pass
+	void DestroyPending()
+	{
+		if (PendingActors.Num() == 0) return;
+		const double StartTime = FPlatformTime::Seconds();
+
+		for (const TWeakObjectPtr<AActor>& WeakActor : PendingActors)
+		{
+			// Might have been destroyed since, e.g. along with its owner
+			AActor* Actor = WeakActor.Get();
+			if (!IsValid(Actor) || !Actor->GetWorld()) continue;
+
+			TInlineComponentArray<UActorComponent*> Components(Actor);
+			if (Actor->GetWorld()->DestroyActor(Actor, false, false))
+			{
+				++Stats.NumActors;
+				Stats.NumComponents += Components.Num();
+			}
+		}
+
+		Stats.DestroySeconds += FPlatformTime::Seconds() - StartTime;
+		PendingActors.Reset();
+	}
+
+	// Destroys whatever is left and runs one garbage collection for everything
+	const FStats& Collect(bool bFullPurge = true)
+	{
+		DestroyPending();
+
+		const int32 NumObjectsBefore = GUObjectArray.GetObjectArrayNumMinusAvailable();
+		const int64 UsedPhysicalBefore = FPlatformMemory::GetStats().UsedPhysical;
+		const double StartTime = FPlatformTime::Seconds();
+		CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS, bFullPurge);
+		Stats.CollectSeconds += FPlatformTime::Seconds() - StartTime;
+		Stats.NumCollectedObjects += FMath::Max(NumObjectsBefore - GUObjectArray.GetObjectArrayNumMinusAvailable(), 0);
+		Stats.ReclaimedBytes += FMath::Max<int64>(UsedPhysicalBefore - int64(FPlatformMemory::GetStats().UsedPhysical), 0);
+
+		return Stats;
+	}
+
+	const FStats& GetStats() const { return Stats; }
+
+private:
+	TArray<TWeakObjectPtr<AActor>> PendingActors;
+	FStats Stats;
+};